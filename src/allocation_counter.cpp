@@ -0,0 +1,102 @@
+#include "allocation_counter.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// allocations of the current thread, so that threads do not disturb each other's measurements
+thread_local AllocationCounter ownAllocations(0);
+// counter shared with other threads, nullptr to use the own one
+thread_local AllocationCounter* sharedAllocations = nullptr;
+
+void
+count_allocation() {
+    AllocationCounter& allocations = sharedAllocations ? *sharedAllocations : ownAllocations;
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Allocator of matrix data which counts the allocations and leaves the work to
+ * the standard allocator of OpenCV.
+ */
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           int flags, cv::UMatUsageFlags usageFlags) const override {
+        // matrices using external data do not allocate
+        if (!data) {
+            count_allocation();
+        }
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, int accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+};
+
+void*
+counted_malloc(size_t size) {
+    count_allocation();
+    // malloc may return nullptr for a size of 0
+    return std::malloc(size ? size : 1);
+}
+
+}
+
+size_t
+allocation_count() {
+    return (sharedAllocations ? *sharedAllocations : ownAllocations).load(std::memory_order_relaxed);
+}
+
+void
+count_allocations_in(AllocationCounter& counter) {
+    sharedAllocations = &counter;
+}
+
+void
+count_mat_allocations() {
+    static CountingMatAllocator allocator;
+    cv::Mat::setDefaultAllocator(&allocator);
+}
+
+void*
+operator new(size_t size) {
+    void* memory = counted_malloc(size);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void*
+operator new[](size_t size) {
+    return operator new(size);
+}
+
+void*
+operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void*
+operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_malloc(size);
+}
+
+void
+operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void
+operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
@@ -0,0 +1,38 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Counter of heap allocations, used to verify that rendering a frame does not allocate.
+ *
+ * Allocations through the global operator new are always counted. Allocations of the
+ * data of matrices are counted once count_mat_allocations was called, which replaces
+ * the default allocator of OpenCV by a counting one. Every thread counts its own
+ * allocations unless it joins the counter of another thread, e.g. the workers a
+ * thread distributes its work to.
+ */
+
+typedef std::atomic<size_t> AllocationCounter;
+
+/**
+ * Number of heap allocations counted by the counter of the calling thread.
+ */
+size_t
+allocation_count();
+
+/**
+ * Count the allocations of the calling thread in counter from now on.
+ * The counter has to outlive the thread.
+ */
+void
+count_allocations_in(AllocationCounter& counter);
+
+/**
+ * Count the allocations of matrix data from now on.
+ */
+void
+count_mat_allocations();
+
+#endif // ALLOCATION_COUNTER_H
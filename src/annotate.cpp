@@ -4,21 +4,34 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "allocation_counter.h"
+#include "brush.h"
+#include "dataset_index.h"
+#include "geometry.h"
+#include "gt_writer.h"
+#include "image_cache.h"
+#include "image_names.h"
+#include "label_file.h"
+#include "progress_store.h"
+#include "redraw_scheduler.h"
+#include "render_thread.h"
+#include "stroke_rasterizer.h"
+#include "undo_history.h"
+
 #include <algorithm>
-#include <limits>
-#include <fstream>
-#include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
-#define WHITE cv::Scalar(255, 255, 255)
-#define BLACK cv::Scalar(0, 0, 0)
-
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-std::map<std::string, std::vector<cv::Rect>> labelMap;
-std::string imageName;
+// defects of the images, loaded in the background
+LabelLoader* labels = nullptr;
+// interned name of the displayed image
+uint32_t imageId = ImageNames::NONE;
 bool displayDefectInfo = true;
 
 // save the current markerSize for editing
@@ -27,21 +40,61 @@ int markerSize = 5;
 int overlay = 35;
 // save if quitting is required
 bool quit = false;
-// save if image name should be displayed
-bool display_filename = false;
+// number of following and previous images decoded ahead of time
+int prefetchNext = 2;
+int prefetchPrevious = 1;
+// report frames whose rendering allocated memory
+bool countAllocations = false;
+// number of threads compositing the view, 0 uses every core
+int renderThreads = 0;
+// pin the threads compositing the view to cores
+bool pinRenderThreads = false;
 
 cv::Point mousePosition;
 cv::Rect zoomRect;
+// size of the rendered view, which matches the size of the window
+cv::Size viewSize(1600, 900);
+
+// renders the view displayed to the user in the background
+RenderThread* renderer = nullptr;
+// longest time in milliseconds the first frame after a pause is waited for
+const int FIRST_FRAME_TIMEOUT_MS = 100;
+// decides when the view is rendered and displayed again
+RedrawScheduler scheduler;
+// shape of the brush and its stamps for every marker size
+Brush brush;
+// strokes painted since the last frame
+StrokeRasterizer strokes;
+// strokes of the displayed GT which can be undone
+UndoHistory* history = nullptr;
+
+/**
+ * Image currently displayed together with its GT.
+ * It is passed to the mouse and trackbar callbacks.
+ */
+struct DisplayedImage {
+    std::shared_ptr<TiledImage> image;
+    std::shared_ptr<TiledGT> imageGT;
+    // incremented for every displayed image
+    unsigned generation;
+    // region of the GT edited since the image is displayed
+    cv::Rect modified;
+    // region of the GT edited since the last frame was requested
+    cv::Rect unrendered;
+};
+DisplayedImage displayed;
+
+void present(DisplayedImage* displayed);
 
 /**
- * Project the current mouse position back onto the original image given
- * a zoomed in rectangle.
+ * Project the current mouse position, given in view coordinates, back onto the
+ * original image given a zoomed in rectangle.
  *
  */
 cv::Point
-global_pos(cv::Mat* imageGT) {
-    float zoomWidthFactor = zoomRect.width / static_cast<float>(imageGT->cols);
-    float zoomHeightFactor = zoomRect.height / static_cast<float>(imageGT->rows);
+global_pos() {
+    float zoomWidthFactor = zoomRect.width / static_cast<float>(viewSize.width);
+    float zoomHeightFactor = zoomRect.height / static_cast<float>(viewSize.height);
     return cv::Point(zoomRect.x + (mousePosition.x * zoomWidthFactor), zoomRect.y + (mousePosition.y * zoomHeightFactor));
 }
 
@@ -54,39 +107,61 @@ global_pos(cv::Mat* imageGT) {
  * In contrast, zooming out can jump a bit in order to keep the rectanlge valid.
  */
 void
-zoom(double factor, cv::Mat* image) {
+zoom(double factor, const cv::Size& imageSize) {
     // store the current position of the cursor without zooming
-    cv::Point zoomPosition = global_pos(image);
+    cv::Point zoomPosition = global_pos();
 
     // these raios have to stay the same so that the mouse cursor stays on the same position
-    double width_ratio = mousePosition.x / static_cast<double>(image->cols);
-    double height_ratio = mousePosition.y / static_cast<double>(image->rows);
+    double width_ratio = mousePosition.x / static_cast<double>(viewSize.width);
+    double height_ratio = mousePosition.y / static_cast<double>(viewSize.height);
 
     // scale width and height according the provided factor
     // make sure that the zooming rectangle is not larger than the image zoomed into
-    zoomRect.width = std::min(image->cols, static_cast<int>(zoomRect.width * factor));
-    zoomRect.height = std::min(image->rows, static_cast<int>(zoomRect.height * factor));
+    zoomRect.width = std::min(imageSize.width, static_cast<int>(zoomRect.width * factor));
+    zoomRect.height = std::min(imageSize.height, static_cast<int>(zoomRect.height * factor));
 
     // change x position in a way that makes the mouse cursor stay on the same position
     zoomRect.x = std::max(0, static_cast<int>(zoomPosition.x - (width_ratio * zoomRect.width)));
     // make sure that the rectangle does not focus parts outside the image
     // this can only happen on zooming out and can lead to 'jumping'
-    zoomRect.x = std::min(zoomRect.x, image->cols - zoomRect.width);
+    zoomRect.x = std::min(zoomRect.x, imageSize.width - zoomRect.width);
 
     // change y position in a way that makes the mouse cursor stay on the same position
     zoomRect.y = std::max(0, static_cast<int>(zoomPosition.y - (height_ratio * zoomRect.height)));
     // make sure that the rectangle does not focus parts outside the image
     // this can only happen on zooming out and can lead to 'jumping'
-    zoomRect.y = std::min(zoomRect.y, image->rows - zoomRect.height);
+    zoomRect.y = std::min(zoomRect.y, imageSize.height - zoomRect.height);
+}
+
+/**
+ * Record that a region of the displayed GT was edited so that it is rendered
+ * again and the GT is saved. Has to be called by everything editing the GT.
+ */
+void
+edited(const cv::Rect& region) {
+    if (region.empty()) {
+        return;
+    }
+    displayed.modified = unite(displayed.modified, region);
+    displayed.unrendered = unite(displayed.unrendered, region);
 }
 
-void mark(cv::Mat *imageGT, const bool asGT) {
-    const cv::Scalar color = asGT ? WHITE : BLACK;
-    const cv::Point globalCursorPos = global_pos(imageGT);
+/**
+ * Stamp of the brush centered on the cursor with the current marker size as radius.
+ */
+const BrushStamp&
+brush_stamp() {
+    return brush.stamp(markerSize);
+}
 
-    cv::Point topLeft(globalCursorPos.x - markerSize, globalCursorPos.y - markerSize);
-    cv::Point bottomRight(topLeft.x + markerSize, topLeft.y + markerSize);
-    cv::rectangle(*imageGT, topLeft, bottomRight, color, CV_FILLED);
+/**
+ * Paint the strokes queued by the mouse events into the displayed GT.
+ * Called once per frame so that each pixel is painted only once however fast the mouse moves.
+ */
+void
+rasterize_strokes(DisplayedImage* displayed) {
+    // only the tiles touched by the strokes are allocated
+    edited(strokes.rasterize(*displayed->imageGT, history));
 }
 
 /**
@@ -101,26 +176,28 @@ void onMouse(int event, int x, int y, int flags, void* userdata) {
         mousePosition = cv::Point(x, y);
     }
 
-    cv::Mat *imageGT = (cv::Mat*) userdata;
-    if (event == cv::EVENT_LBUTTONDOWN || (event == cv::EVENT_MOUSEMOVE && flags & cv::EVENT_FLAG_LBUTTON)) {
-        mark(imageGT, true);
-    } else if (event == cv::EVENT_RBUTTONDOWN || (event == cv::EVENT_MOUSEMOVE && flags & cv::EVENT_FLAG_RBUTTON)) {
-        mark(imageGT, false);
-    } else if (event == cv::EVENT_MOUSEMOVE) {
-        if (flags & cv::EVENT_FLAG_LBUTTON) {
-            mark(imageGT, true);
-        } else if (flags & cv::EVENT_FLAG_RBUTTON) {
-            mark(imageGT, false);
-        }
+    DisplayedImage *displayed = (DisplayedImage*) userdata;
+    TiledGT *imageGT = displayed->imageGT.get();
+    // strokes are only queued here and painted once per frame
+    if (event == cv::EVENT_LBUTTONDOWN) {
+        strokes.begin(global_pos(), brush_stamp(), 255);
+    } else if (event == cv::EVENT_RBUTTONDOWN) {
+        strokes.begin(global_pos(), brush_stamp(), 0);
+    } else if (event == cv::EVENT_MOUSEMOVE && flags & cv::EVENT_FLAG_LBUTTON) {
+        strokes.extend(global_pos(), brush_stamp(), 255);
+    } else if (event == cv::EVENT_MOUSEMOVE && flags & cv::EVENT_FLAG_RBUTTON) {
+        strokes.extend(global_pos(), brush_stamp(), 0);
+    } else if (event == cv::EVENT_LBUTTONUP || event == cv::EVENT_RBUTTONUP) {
+        strokes.end();
     } else if (event == cv::EVENT_MOUSEHWHEEL) {
         bool inwards = cv::getMouseWheelDelta(flags) < 0;
 
         if (flags & cv::EVENT_FLAG_CTRLKEY) {
             // if ctrl key is pressed zoom in/out
             if (inwards) {
-                zoom(0.95, imageGT);
+                zoom(0.95, imageGT->size());
             } else {
-                zoom(1.0 / 0.95, imageGT);
+                zoom(1.0 / 0.95, imageGT->size());
             }
         } else if (flags & cv::EVENT_FLAG_SHIFTKEY) {
             // modify overlay if shift key is pressed (tried alt key but it did not work)
@@ -140,105 +217,155 @@ void onMouse(int event, int x, int y, int flags, void* userdata) {
             cv::setTrackbarPos("Size", "AnnotationTool", markerSize);
         }
     }
+
+    // every mouse event at least moves the marker
+    scheduler.invalidate();
+    if (scheduler.due()) {
+        present(displayed);
+    }
 }
 
 /**
- * Empty callback because property is directly bound to trackbar.
+ * Callback redrawing the view because the property is directly bound to the trackbar.
  */
 void onTrackbarSizeChange(int event, void* userdata) {
+    scheduler.invalidate();
+    if (scheduler.due()) {
+        present((DisplayedImage*) userdata);
+    }
 }
 
 /**
- * Empty callback because property is directly bound to trackbar.
+ * Callback redrawing the view because the property is directly bound to the trackbar.
  */
 void onTrackbarBlendingChange(int event, void* userdata) {
+    scheduler.invalidate();
+    if (scheduler.due()) {
+        present((DisplayedImage*) userdata);
+    }
 }
 
 /**
- * Create a vector of files in a given directory.
+ * Describe the view to display to the user. It contains a zoomed in blend between the image
+ * and the GT together with the defects of the image and a marker around the cursor.
  */
-std::vector<fs::path> get_files_from_dir(std::string dir) {
-    // create vector
-    std::vector<fs::path> files;
-
-    // create end iterator
-    fs::directory_iterator end_itr;
-    // iterate over entries in directory
-    for (fs::directory_iterator itr(dir); itr != end_itr; itr++) {
-        // skip directories
-        if (fs::is_directory(itr->path())) {
-            continue;
-        }
-
-        // add file to vector
-        files.push_back(itr->path());
+ViewState
+create_view_state(DisplayedImage* displayed) {
+    ViewState state;
+    state.image = displayed->image;
+    state.imageGT = displayed->imageGT;
+    state.generation = displayed->generation;
+    state.zoomRect = zoomRect;
+    state.viewSize = viewSize;
+    state.overlay = overlay;
+    state.defects = nullptr;
+    if (displayDefectInfo) {
+        // defects are not drawn until the label file is loaded
+        state.defects = labels->find(imageId);
     }
 
-    // return vector
-    return files;
+    // marker around the brush centered on the cursor in view coordinates
+    double zoomFactor = viewSize.width / static_cast<double>(zoomRect.width);
+    const int extent = static_cast<int>((std::max(markerSize, 0) + 0.5) * zoomFactor + 0.5);
+    cv::Point topLeft(mousePosition.x - extent, mousePosition.y - extent);
+    cv::Point bottomRight(mousePosition.x + extent, mousePosition.y + extent);
+    state.marker = cv::Rect(topLeft, bottomRight);
+
+    // only regions changed since the last frame are blended and zoomed again
+    state.edited = displayed->unrendered;
+    displayed->unrendered = cv::Rect();
+    return state;
 }
 
 /**
- * Create an image to display to the user. This image contains a zoomed in blend between the image
- * and the GT on the left side, the current GT on the top right and control information
- * on the bottom right side.
+ * Compute the size of a view with the aspect ratio of an image which fills the window.
  */
-cv::Mat
-create_image_to_show(cv::Mat* image, cv::Mat* imageGT, std::string image_file = "") {
-    // create image to show with enough space to display blend, GT and info
-    cv::Mat image_to_show(image->rows, image->cols + (0.5 * image->cols), image->type());
-
-    // create blended image
-    cv::Mat blend;
-    // add weighted GT to image to create blend
-    cv::addWeighted(*image, 1.0, *imageGT, overlay / 100.0, 0.0, blend);
-
-    if (displayDefectInfo && labelMap.find(imageName) != labelMap.end()) {
-        for (const cv::Rect r : labelMap[imageName]) {
-            cv::rectangle(blend, r, cv::Scalar(255, 0, 0), 2);
-        }
+cv::Size
+window_view_size(const cv::Size& imageSize) {
+    cv::Rect window = cv::getWindowImageRect("AnnotationTool");
+    // keep the last size if the window size is not available
+    if (window.width <= 0 || window.height <= 0) {
+        return viewSize;
     }
 
-    // create zoomed as part of image to show
-    cv::Mat zoomed(image_to_show, cv::Rect(0, 0, image->cols, image->rows));
-    // zoom in by projecting rectangle of blend onto zoomed
-    cv::resize(blend(zoomRect), zoomed, blend.size());
+    double scale = std::min(window.width / static_cast<double>(imageSize.width),
+                            window.height / static_cast<double>(imageSize.height));
+    return cv::Size(std::max(1, static_cast<int>(imageSize.width * scale + 0.5)),
+                    std::max(1, static_cast<int>(imageSize.height * scale + 0.5)));
+}
 
-    // draw marker
-    double zoomFactor = imageGT->cols / static_cast<double>(zoomRect.width);
-    cv::Point topLeft(mousePosition.x - (markerSize * zoomFactor) - 1, mousePosition.y - (markerSize * zoomFactor) - 1);
-    cv::Point bottomRight(topLeft.x + (markerSize * zoomFactor) + 1, topLeft.y + (markerSize * zoomFactor) + 1);
-    cv::rectangle(image_to_show, topLeft, bottomRight, BLACK, 1);
+/**
+ * Request a frame of the view at the resolution of the window from the render thread.
+ * Frames requested while the event loop sleeps with its long timeout, i.e. the first
+ * changes after a pause, are waited for and displayed directly, since the event loop
+ * would only display them once it wakes up. Otherwise the event loop polls for them.
+ */
+void
+present(DisplayedImage* displayed) {
+    rasterize_strokes(displayed);
+    viewSize = window_view_size(displayed->image->size());
+    renderer->submit(create_view_state(displayed));
+    scheduler.presented();
+
+    cv::Mat frame;
+    if (scheduler.sleeping() && renderer->wait(frame, FIRST_FRAME_TIMEOUT_MS)) {
+        cv::imshow("AnnotationTool", frame);
+    }
+}
 
-    return zoomed;
+/**
+ * Display the newest frame of the render thread if there is one.
+ */
+void
+show_latest_frame() {
+    cv::Mat frame;
+    if (renderer->latest(frame)) {
+        cv::imshow("AnnotationTool", frame);
+    }
 }
 
 /**
  * Display a provided image and its GT for a user to interactively annotate it.
  */
 int
-annotate_image(cv::Mat* image, cv::Mat* imageGT, std::string image_file = "") {
+annotate_image(std::shared_ptr<TiledImage> image, std::shared_ptr<TiledGT> imageGT) {
     // create resizable window
     cv::namedWindow("AnnotationTool", cv::WINDOW_NORMAL | cv::WINDOW_KEEPRATIO | cv::WINDOW_GUI_EXPANDED);
     // set initial window size
     cv::resizeWindow("AnnotationTool", 1600, 900);
 
+    // the callbacks may outlive this call, so the displayed image is kept globally
+    displayed.image = image;
+    displayed.imageGT = imageGT;
+    // nothing rendered so far belongs to this image
+    displayed.generation++;
+    displayed.modified = cv::Rect();
+    displayed.unrendered = cv::Rect();
+    // strokes do not continue on another image and cannot be undone on it
+    strokes.end();
+    history->clear();
+
     // add callback to handle mouse events
-    cv::setMouseCallback("AnnotationTool", onMouse, imageGT);
+    cv::setMouseCallback("AnnotationTool", onMouse, &displayed);
     // add trackbars and callbacks
-    cv::createTrackbar("Size", "AnnotationTool", &markerSize, 50, onTrackbarSizeChange);
-    cv::createTrackbar("Blending", "AnnotationTool", &overlay, 100, onTrackbarBlendingChange);
+    cv::createTrackbar("Size", "AnnotationTool", &markerSize, 50, onTrackbarSizeChange, &displayed);
+    cv::createTrackbar("Blending", "AnnotationTool", &overlay, 100, onTrackbarBlendingChange, &displayed);
 
     // cv::Rect zoomRect;
-    zoomRect = cv::Rect(0, 0, imageGT->cols, imageGT->rows);
+    zoomRect = cv::Rect(cv::Point(0, 0), imageGT->size());
 
     // display image
-    cv::imshow("AnnotationTool", create_image_to_show(image, imageGT));
+    present(&displayed);
+    bool labelsReady = labels->ready();
 
     // iterate as long as user is not finished
     while (true) {
-        // handle events at 60 fps
-        int key = cv::waitKey(1000 / 60);
+        // handle events until a frame is due, but render only if something changed
+        // and poll for the frame while it is rendered
+        int key = cv::waitKey(renderer->busy() ? 1 : scheduler.timeout());
+        scheduler.woken();
+        // the GT has to contain all strokes before it is saved
+        rasterize_strokes(&displayed);
 
         // handle key events
         switch (key) {
@@ -265,33 +392,30 @@ annotate_image(cv::Mat* image, cv::Mat* imageGT, std::string image_file = "") {
                 markerSize -= 5;
                 cv::setTrackbarPos("Size", "AnnotationTool", markerSize);
                 break;
-            case 'i':
-                display_filename = !display_filename;
-                break;
             case 'f':
                 // do not zoom if cursor is outside the image
-                if (mousePosition.x > imageGT->cols || mousePosition.y > imageGT->rows) {
+                if (mousePosition.x > viewSize.width || mousePosition.y > viewSize.height) {
                     break;
                 }
 
                 // zoom in
-                zoom(0.8, imageGT);
+                zoom(0.8, imageGT->size());
                 break;
             case 'g':
                 // do not zoom if cursor is outside the image
-                if (mousePosition.x > imageGT->cols || mousePosition.y > imageGT->rows) {
+                if (mousePosition.x > viewSize.width || mousePosition.y > viewSize.height) {
                     break;
                 }
 
                 // zoom out
-                zoom(1.0 / 0.8, imageGT);
+                zoom(1.0 / 0.8, imageGT->size());
                 break;
             case 'G':
                 // zoom out completely
                 zoomRect.x = 0;
                 zoomRect.y = 0;
-                zoomRect.width = imageGT->cols;
-                zoomRect.height = imageGT->rows;
+                zoomRect.width = imageGT->size().width;
+                zoomRect.height = imageGT->size().height;
                 break;
             // Note: w,a,s,d are used for moving instead of the arrow keys because
             // the arrow keys seem to change the trackbars in openCV per default
@@ -305,102 +429,155 @@ annotate_image(cv::Mat* image, cv::Mat* imageGT, std::string image_file = "") {
                 break;
             case 'd':
                 // move zooming rectangle right relative to its width
-                zoomRect.x = std::min(imageGT->cols - zoomRect.width, zoomRect.x + static_cast<int>(0.2 * zoomRect.width));
+                zoomRect.x = std::min(imageGT->size().width - zoomRect.width, zoomRect.x + static_cast<int>(0.2 * zoomRect.width));
                 break;
             case 's':
                 // move zooming rectangle down relative to its height
-                zoomRect.y = std::min(imageGT->rows - zoomRect.height, zoomRect.y + static_cast<int>(0.2 * zoomRect.height));
+                zoomRect.y = std::min(imageGT->size().height - zoomRect.height, zoomRect.y + static_cast<int>(0.2 * zoomRect.height));
                 break;
             case 'z':
                 displayDefectInfo = !displayDefectInfo;
                 break;
+            case 'u':
+                // undo the last stroke
+                strokes.end();
+                edited(history->undo(*imageGT));
+                break;
+            case 'r':
+                // redo the last undone stroke
+                strokes.end();
+                edited(history->redo(*imageGT));
+                break;
             default:
                 // uncomment to find out keys by number
                 // std::cout << "Key: " << key << std::endl;
                 break;
         }
-        cv::Mat image_to_show = create_image_to_show(image, imageGT, display_filename ? image_file : "");
+        if (key != -1) {
+            scheduler.invalidate();
+        }
+        // resizing the window does not create an event
+        if (window_view_size(image->size()) != viewSize) {
+            scheduler.invalidate();
+        }
+        // the defects are drawn as soon as they are loaded
+        if (!labelsReady && labels->ready()) {
+            labelsReady = true;
+            scheduler.invalidate();
+        }
+
         // re-render image
-        cv::imshow("AnnotationTool", image_to_show);
+        if (scheduler.due()) {
+            present(&displayed);
+        }
+        show_latest_frame();
     }
 
     return 0;
 }
 
 /**
- * Annotate a list of images from a provided directory and save them at the provided
- * output directory. An index can be specified to skip this many images from the directory.
+ * Create the list of images (and their GTs) which should be prefetched when displaying
+ * the image at the given index. These are the following images which are not annotated,
+ * because they are displayed next, and the previous images, ordered by their distance.
+ */
+std::vector<ImageCache::Files>
+prefetch_window(DatasetIndex& index, size_t current) {
+    std::vector<ImageCache::Files> window;
+    auto add = [&](size_t j) {
+        window.push_back(ImageCache::Files(index.imagePath(j), index.gtPath(j)));
+    };
+
+    add(current);
+    size_t following = current;
+    for (int distance = 1; distance <= std::max(prefetchNext, prefetchPrevious); distance++) {
+        if (distance <= prefetchNext) {
+            following = index.nextUnannotated(following + 1);
+            if (following < index.size()) {
+                add(following);
+            }
+        }
+        if (distance <= prefetchPrevious && current >= static_cast<size_t>(distance)) {
+            add(current - distance);
+        }
+    }
+    return window;
+}
+
+/**
+ * Annotate the images of an index and save their GTs. Images which are already annotated
+ * are skipped. An index can be specified to skip this many images and the name of an
+ * image can be specified to skip to. Navigating only uses the index and never decodes
+ * images which are skipped.
  */
 void
-annotate(std::string image_dir, std::string output_dir, int start_index, std::string skipTo) {
-    std::vector<fs::path> files = get_files_from_dir(image_dir);
-
-    // read in files that were already annotated
-    std::string annotatedFileName = output_dir + "/.annotated.txt";
-    std::vector<std::string> alreadyAnnotatedFiles;
-    std::ifstream annotationFile(annotatedFileName);
-    for (std::string line; std::getline(annotationFile, line); ) {
-       alreadyAnnotatedFiles.push_back(line);
+annotate(DatasetIndex& index, int start_index, std::string skipTo, ImageCache& cache, GtWriter& writer) {
+    // resolve the first image to display
+    size_t i;
+    if (skipTo != "") {
+        i = index.find(skipTo);
+        if (i == index.size()) {
+            std::cout << "Error! Image[" << skipTo << "] to skip to is not available!" << std::endl;
+            return;
+        }
+    } else {
+        i = index.nextUnannotated(std::max(start_index, 0));
     }
 
-    // save index and if it should be skipped to a certain file
-    int i = start_index;
-    bool skipped = skipTo == "";
-    bool alreadyAnnotated;
-    while (i < files.size()) {
-        // retrieve current file from array
-        fs::path image_file = files[i];
-        // load input image
-        cv::Mat image = cv::imread(image_file.string());
-        std::cout << i << "/" << files.size() << " - Loaded Image: " << image_file << std::endl;
-        if (image.empty()) {
+    while (i < index.size()) {
+        // retrieve current file from the index
+        std::string image_file = index.imagePath(i);
+        // output file matching to input image
+        std::string output_file = index.gtPath(i);
+        imageId = index.nameId(i);
+
+        // decode the surrounding images in the background
+        cache.prefetch(prefetch_window(index, i));
+        // load input image and GT, usually already done by the prefetching
+        CachedImage loaded = cache.get(ImageCache::Files(image_file, output_file));
+        std::shared_ptr<TiledImage> image = loaded.image;
+        std::cout << i << "/" << index.size() << " - Loaded Image: " << image_file << std::endl;
+        if (!image) {
             std::cout << "Could not load image " << image_file << "!" << std::endl;
+            i = index.nextUnannotated(i + 1);
             continue;
         }
-        imageName = image_file.string().substr(image_file.string().size() - 10, 6);
-        alreadyAnnotated = std::find(alreadyAnnotatedFiles.begin(), alreadyAnnotatedFiles.end(), imageName) != alreadyAnnotatedFiles.end();
-        if (!skipped && skipTo != imageName) {
-            i++;
-            continue;
-        } else {
-            if (skipped && alreadyAnnotated) {
-                i++;
-                continue;
-            }
-            skipped = true;
-        }
 
-        // create output file matching to input image
-        std::string output_file = output_dir + "/" + image_file.filename().string();
-        // create GT
-        cv::Mat imageGT;
-        if (fs::exists(output_file)) {
-            // if already available load matching GT
-            imageGT = cv::imread(output_file);
-            std::cout << "Loaded GT: " << output_file << std::endl;
-        } else {
-            // create black GT
-            imageGT = cv::Mat(image.size(), CV_8UC3, BLACK);
+        // matching GT, black if there was none
+        // it is shared with the cache so that edits are kept when returning to the image
+        std::shared_ptr<TiledGT> imageGT = loaded.imageGT;
+        if (loaded.gtLoaded) {
+            std::cout << "Loaded GT: " << output_file << " (" << imageGT->allocatedTiles() << "/"
+                      << imageGT->columns() * imageGT->rows() << " tiles annotated)" << std::endl;
         }
 
         // display GUI to annotate, returns when jumping to next/previous image is required
-        i += annotate_image(&image, &imageGT, image_file.filename().string());
+        int step = annotate_image(image, imageGT);
 
         // quit if value was set
         if (quit) {
             return;
         }
 
-        // save annotated GT
-        cv::Mat output_image;
-        cv::cvtColor(imageGT, output_image, cv::COLOR_RGB2GRAY);
-        cv::imwrite(output_file, output_image);
+        // save annotated GT in the background, which is skipped if it was not edited
+        // unless there is no GT file yet
+        if (!displayed.modified.empty() || !index.gtExists(i)) {
+            // the writer reports the statistics of the GT once it is written
+            writer.save(output_file, *imageGT);
+            index.setGtExists(i);
+        }
 
         // save that image was annotated
-        if (!alreadyAnnotated) {
-            std::ofstream annotationFileO(annotatedFileName, std::ios_base::app | std::ios_base::out);
-            annotationFileO << imageName << "\n";
-            annotationFileO.close();
+        if (!index.annotated(i)) {
+            writer.journal(index.name(i), output_file);
+            index.setAnnotated(i);
+        }
+
+        // continue with the next image which is not annotated or the previous image
+        if (step > 0) {
+            i = index.nextUnannotated(i + 1);
+        } else if (step < 0 && i > 0) {
+            i--;
         }
     }
 }
@@ -410,36 +587,18 @@ annotate(std::string image_dir, std::string output_dir, int start_index, std::st
  */
 int
 main(int argc, char** argv) {
-    std::ifstream labelFile("manlabel.txt");
-    std::string filename, defectType;
-    int xMin, yMin, xMax, yMax;
-    // the images as expected here are extracted part of the original images,
-    // thus, the rectanlges have to be moved to fit the extracted part
-    // how much they need to be moved is saved in this map
-    std::map<std::string, cv::Point> anchorPointMap;
-    while (labelFile >> filename >> yMin >> xMin >> yMax >> xMax >> defectType) {
-        if (anchorPointMap.find(filename) == anchorPointMap.end()) {
-            anchorPointMap[filename] = cv::Point(std::numeric_limits<int>().max(), std::numeric_limits<int>().max());
-        }
-        anchorPointMap[filename].x = std::min(anchorPointMap[filename].x, xMin);
-        anchorPointMap[filename].y = std::min(anchorPointMap[filename].y, yMin);
-
-        if (defectType == "sound") {
-            continue;
-        }
-
-        labelMap[filename].push_back(cv::Rect(xMin, yMin, xMax - xMin, yMax - yMin));
-    }
-    for (auto& entry : labelMap) {
-        for (cv::Rect& rect : entry.second) {
-            rect -= anchorPointMap[entry.first];
-        }
-    }
-
     // create variables with default values
     int start_index;
     std::string output_dir;
     std::string skipTo;
+    int refreshRate;
+    int cacheSize;
+    int prefetchThreads;
+    std::string namePattern;
+    bool packedGT;
+    std::string brushShape;
+    int undoBudget;
+    bool compressUndo;
 
     // add program options
     po::options_description desc("GUI to annotate images from within a specified directory. Allowed options");
@@ -449,6 +608,19 @@ main(int argc, char** argv) {
         ("output_dir,o", po::value<std::string>(&output_dir)->default_value("GT"), "set the directory where the annotated images will be stored")
         ("start_index", po::value<int>(&start_index)->default_value(0), "set the start index")
         ("skip_to", po::value<std::string>(&skipTo)->default_value(""), "set the name of the image file to which it should be skipped")
+        ("refresh_rate", po::value<int>(&refreshRate)->default_value(60), "set the maximal number of frames displayed per second")
+        ("prefetch_next", po::value<int>(&prefetchNext)->default_value(2), "set the number of following images decoded ahead of time")
+        ("prefetch_previous", po::value<int>(&prefetchPrevious)->default_value(1), "set the number of previous images decoded ahead of time")
+        ("prefetch_threads", po::value<int>(&prefetchThreads)->default_value(2), "set the number of threads decoding images ahead of time")
+        ("cache_size", po::value<int>(&cacheSize)->default_value(1024), "set the memory budget in MB for decoded images")
+        ("name_pattern", po::value<std::string>(&namePattern)->default_value(""), "set the regular expression extracting the image name from the image path, by default the six characters in front of the extension")
+        ("count_allocations", po::bool_switch(&countAllocations), "report frames whose rendering allocated memory, which only happens if the window or the viewport changed or tiles of the GT were labeled for the first time")
+        ("render_threads", po::value<int>(&renderThreads)->default_value(0), "set the number of threads compositing the view, 0 uses one per core")
+        ("pin_render_threads", po::bool_switch(&pinRenderThreads), "pin the threads compositing the view to separate cores, which is skipped if the process may not use enough cores")
+        ("brush", po::value<std::string>(&brushShape)->default_value("square"), "set the shape of the brush, square, circle or the path of an image whose bright pixels are painted")
+        ("undo_budget", po::value<int>(&undoBudget)->default_value(256), "set the memory budget in MB for undoing strokes")
+        ("compress_undo", po::bool_switch(&compressUndo), "run length encode the strokes kept for undoing them")
+        ("packed_gt", po::bool_switch(&packedGT), "store binary GTs with a bit per pixel in memory, labels other than 0 become 255")
     ;
 
     // mark image dir as a positional option
@@ -492,7 +664,57 @@ main(int argc, char** argv) {
         fs::create_directory(output_dir);
     }
 
+    if (!brush.setShape(brushShape)) {
+        std::cout << "Error! Brush image[" << brushShape << "] could not be read!" << std::endl;
+        return 1;
+    }
+
+    scheduler.setRefreshRate(refreshRate);
+    if (countAllocations) {
+        count_mat_allocations();
+    }
+    UndoHistory undoHistory(static_cast<size_t>(std::max(undoBudget, 0)) * 1024 * 1024, compressUndo);
+    history = &undoHistory;
+
+    // journal of the images that were already annotated
+    ProgressStore progress(output_dir + "/.annotated.txt");
+    if (!progress.load()) {
+        std::cout << "Error! Could not read the journal of annotated images!" << std::endl;
+        return 1;
+    }
+
+    // rule deriving the image names used by the journal and the label file
+    NameRule nameRule;
+    try {
+        nameRule = NameRule(namePattern);
+    } catch (const std::regex_error& e) {
+        std::cout << "Error! Name pattern[" << namePattern << "] is invalid: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // index of the images to annotate, which is refreshed where the directories changed
+    DatasetIndex index(image_dir, output_dir, nameRule);
+    index.load();
+    index.setAnnotated(progress.names());
+    index.save();
+
+    // defects of the images, which are cached next to the label file
+    LabelLoader labelLoader("manlabel.txt", std::thread::hardware_concurrency(), index.imageNames());
+    labels = &labelLoader;
+    // the render thread is stopped before the label loader is destroyed,
+    // since the frame it may still render points to the defects of the loader
+    RenderThread renderThread(countAllocations, static_cast<unsigned>(std::max(renderThreads, 0)), pinRenderThreads);
+    renderer = &renderThread;
+
+    // writer of GTs and the journal of annotated images in the background,
+    // which writes everything still pending when it is destroyed
+    GtWriter writer(progress);
+    // cache of decoded images filled in the background
+    ImageCache cache(static_cast<size_t>(std::max(cacheSize, 0)) * 1024 * 1024, std::max(prefetchThreads, 1), &writer,
+                     packedGT);
+
     // start annotation
-    annotate(image_dir, output_dir, start_index, skipTo);
+    annotate(index, start_index, skipTo, cache, writer);
+    index.save();
     return 0;
 }
@@ -0,0 +1,124 @@
+#include "bit_mask.h"
+
+#include "simd_dispatch.h"
+
+#include <cstdint>
+
+namespace {
+
+// expands every bit of a number of bytes into 8 labels
+typedef void (*UnpackBytes)(const uchar* bits, int bytes, uchar* labels);
+
+void
+unpack_bytes_scalar(const uchar* bits, int bytes, uchar* labels) {
+    for (int i = 0; i < bytes; i++) {
+        for (int b = 0; b < 8; b++) {
+            labels[8 * i + b] = (bits[i] >> b) & 1 ? 255 : 0;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+void
+unpack_bytes_sse2(const uchar* bits, int bytes, uchar* labels) {
+    // bit b of every byte, repeated for two bytes
+    const __m128i select = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    int i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        // repeat every byte 8 times, resulting in 4 vectors of 2 bytes each
+        const __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bits + i));
+        const __m128i pairs = _mm_unpacklo_epi8(packed, packed);
+        const __m128i quads[2] = { _mm_unpacklo_epi16(pairs, pairs), _mm_unpackhi_epi16(pairs, pairs) };
+        for (int q = 0; q < 2; q++) {
+            const __m128i low = _mm_unpacklo_epi32(quads[q], quads[q]);
+            const __m128i high = _mm_unpackhi_epi32(quads[q], quads[q]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(labels + 8 * i + 32 * q),
+                             _mm_cmpeq_epi8(_mm_and_si128(low, select), select));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(labels + 8 * i + 32 * q + 16),
+                             _mm_cmpeq_epi8(_mm_and_si128(high, select), select));
+        }
+    }
+    unpack_bytes_scalar(bits + i, bytes - i, labels + 8 * i);
+}
+#endif
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2"))) void
+unpack_bytes_avx2(const uchar* bits, int bytes, uchar* labels) {
+    // bytes 0 and 1 fill the lower lane, bytes 2 and 3 the upper lane
+    const __m256i spread = _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                           1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i select = _mm256_set1_epi64x(static_cast<long long>(0x8040201008040201ULL));
+    int i = 0;
+    for (; i + 4 <= bytes; i += 4) {
+        int32_t packed;
+        __builtin_memcpy(&packed, bits + i, sizeof(packed));
+        const __m256i repeated = _mm256_shuffle_epi8(_mm256_set1_epi32(packed), spread);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + 8 * i),
+                            _mm256_cmpeq_epi8(_mm256_and_si256(repeated, select), select));
+    }
+    unpack_bytes_scalar(bits + i, bytes - i, labels + 8 * i);
+}
+#endif
+
+// fastest implementation supported by the processor
+const UnpackBytes unpack_bytes = select_implementation<UnpackBytes>(
+    SIMD_AVX2_FUNCTION(unpack_bytes_avx2), SIMD_SSE2(unpack_bytes_sse2), unpack_bytes_scalar);
+
+}
+
+void
+set_bits(uchar* bits, int first, int count, bool value) {
+    if (count <= 0) {
+        return;
+    }
+    uint64_t* words = reinterpret_cast<uint64_t*>(bits);
+    const int last = first + count - 1;
+    const uint64_t head = ~0ULL << (first & 63);
+    const uint64_t tail = ~0ULL >> (63 - (last & 63));
+    for (int w = first >> 6; w <= last >> 6; w++) {
+        uint64_t mask = ~0ULL;
+        if (w == first >> 6) {
+            mask &= head;
+        }
+        if (w == last >> 6) {
+            mask &= tail;
+        }
+        words[w] = value ? (words[w] | mask) : (words[w] & ~mask);
+    }
+}
+
+void
+unpack_bits(const uchar* bits, int first, int count, uchar* labels) {
+    // bits before the first whole byte
+    int i = 0;
+    for (; i < count && (first + i) % 8 != 0; i++) {
+        const int b = first + i;
+        labels[i] = (bits[b >> 3] >> (b & 7)) & 1 ? 255 : 0;
+    }
+    const int bytes = (count - i) / 8;
+    unpack_bytes(bits + ((first + i) >> 3), bytes, labels + i);
+    i += 8 * bytes;
+    for (; i < count; i++) {
+        const int b = first + i;
+        labels[i] = (bits[b >> 3] >> (b & 7)) & 1 ? 255 : 0;
+    }
+}
+
+void
+pack_bits(const uchar* labels, int first, int count, uchar* bits) {
+    for (int i = 0; i < count; i++) {
+        const int b = first + i;
+        const uchar bit = static_cast<uchar>(1 << (b & 7));
+        bits[b >> 3] = labels[i] ? (bits[b >> 3] | bit) : (bits[b >> 3] & ~bit);
+    }
+}
+
+size_t
+count_bits(const uchar* bits, size_t bytes) {
+    size_t count = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        count += __builtin_popcount(bits[i]);
+    }
+    return count;
+}
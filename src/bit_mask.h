@@ -0,0 +1,41 @@
+#ifndef BIT_MASK_H
+#define BIT_MASK_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+
+/**
+ * Helpers for rows of binary labels packed into bits.
+ *
+ * Bit i of a row is bit i % 8 of byte i / 8, which on little endian machines is
+ * also bit i % 64 of 64 bit word i / 64. Rows passed to set_bits have to be
+ * aligned to 8 bytes and padded to whole words. A set bit is the label 255.
+ */
+
+/**
+ * Set or clear count bits starting at bit first, a word at a time.
+ */
+void
+set_bits(uchar* bits, int first, int count, bool value);
+
+/**
+ * Expand count bits starting at bit first into labels of 0 or 255.
+ * Uses AVX2 or SSE2 if the processor supports them.
+ */
+void
+unpack_bits(const uchar* bits, int first, int count, uchar* labels);
+
+/**
+ * Pack count labels into the bits starting at bit first. Every label other than 0 sets its bit.
+ */
+void
+pack_bits(const uchar* labels, int first, int count, uchar* bits);
+
+/**
+ * Count the set bits of a number of bytes.
+ */
+size_t
+count_bits(const uchar* bits, size_t bytes);
+
+#endif // BIT_MASK_H
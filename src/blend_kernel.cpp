@@ -0,0 +1,260 @@
+#include "blend_kernel.h"
+
+#include "simd_dispatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// adds two rows of bytes with saturation
+typedef void (*AddSaturate)(const uchar* a, const uchar* b, uchar* out, int bytes);
+
+void
+add_saturate_scalar(const uchar* a, const uchar* b, uchar* out, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast<uchar>(std::min(255, a[i] + b[i]));
+    }
+}
+
+#if defined(__SSE2__)
+void
+add_saturate_sse2(const uchar* a, const uchar* b, uchar* out, int bytes) {
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i sum = _mm_adds_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), sum);
+    }
+    add_saturate_scalar(a + i, b + i, out + i, bytes - i);
+}
+#endif
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2"))) void
+add_saturate_avx2(const uchar* a, const uchar* b, uchar* out, int bytes) {
+    int i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        const __m256i sum = _mm256_adds_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                             _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), sum);
+    }
+    add_saturate_scalar(a + i, b + i, out + i, bytes - i);
+}
+#endif
+
+// fastest implementation supported by the processor
+const AddSaturate add_saturate = select_implementation<AddSaturate>(
+    SIMD_AVX2_FUNCTION(add_saturate_avx2), SIMD_SSE2(add_saturate_sse2), add_saturate_scalar);
+
+// adds a row of bytes to a row of sums
+typedef void (*Accumulate)(const uchar* row, uint32_t* sums, int bytes);
+
+void
+accumulate_scalar(const uchar* row, uint32_t* sums, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        sums[i] += row[i];
+    }
+}
+
+#if defined(__SSE2__)
+void
+accumulate_sse2(const uchar* row, uint32_t* sums, int bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        const __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        const __m128i high = _mm_unpackhi_epi8(pixels, zero);
+        const __m128i words[4] = { _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                                   _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero) };
+        for (int k = 0; k < 4; k++) {
+            __m128i* sum = reinterpret_cast<__m128i*>(sums + i + 4 * k);
+            _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), words[k]));
+        }
+    }
+    accumulate_scalar(row + i, sums + i, bytes - i);
+}
+#endif
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2"))) void
+accumulate_avx2(const uchar* row, uint32_t* sums, int bytes) {
+    int i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        const __m256i words = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i)));
+        __m256i* sum = reinterpret_cast<__m256i*>(sums + i);
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), words));
+    }
+    accumulate_scalar(row + i, sums + i, bytes - i);
+}
+#endif
+
+const Accumulate accumulate = select_implementation<Accumulate>(
+    SIMD_AVX2_FUNCTION(accumulate_avx2), SIMD_SSE2(accumulate_sse2), accumulate_scalar);
+
+}
+
+void
+BlendKernel::weightColors(const cv::Vec3b* labelColors, int overlay, cv::Vec3b* weighted) {
+    // weight with 8 fractional bits
+    const int weight = (std::max(0, overlay) * 256 + 50) / 100;
+    for (int label = 0; label < 256; label++) {
+        for (int c = 0; c < 3; c++) {
+            weighted[label][c] = static_cast<uchar>(std::min(255, (labelColors[label][c] * weight + 128) >> 8));
+        }
+    }
+}
+
+/**
+ * Blend the source pixels [x0, x1) of a row into out.
+ */
+void
+BlendKernel::blendRow(const BlendSources& sources, int y, int x0, int x1, uchar* out) {
+    const int width = x1 - x0;
+    const uchar* labels = sources.labels.ptr<uchar>(y) + x0;
+    colorRow.resize(3 * width);
+    for (int i = 0; i < width; i++) {
+        const cv::Vec3b& color = sources.colors[labels[i]];
+        colorRow[3 * i] = color[0];
+        colorRow[3 * i + 1] = color[1];
+        colorRow[3 * i + 2] = color[2];
+    }
+    add_saturate(sources.image.ptr<uchar>(y) + 3 * x0, colorRow.data(), out, 3 * width);
+
+    if (!sources.outlines.empty()) {
+        const uchar* outlines = sources.outlines.ptr<uchar>(y) + x0;
+        for (int i = 0; i < width; i++) {
+            if (outlines[i]) {
+                out[3 * i] = sources.outlineColor[0];
+                out[3 * i + 1] = sources.outlineColor[1];
+                out[3 * i + 2] = sources.outlineColor[2];
+            }
+        }
+    }
+}
+
+/**
+ * Nearest neighbor sampling: every view pixel is the blended source pixel at its center.
+ */
+template<>
+void
+BlendKernel::resample<BlendKernel::NEAREST>(const BlendSources& sources, const cv::Rect& region, cv::Mat& view) {
+    const int x0 = columnStart.front();
+    const int x1 = columnEnd.back();
+    blendedRow.resize(3 * (x1 - x0));
+
+    for (int j = 0; j < region.height; j++) {
+        uchar* out = view.ptr<uchar>(region.y + j) + 3 * region.x;
+        // rows sampling the same source row are identical
+        if (j > 0 && rowStart[j] == rowStart[j - 1]) {
+            std::memcpy(out, view.ptr<uchar>(region.y + j - 1) + 3 * region.x, 3 * region.width);
+            continue;
+        }
+
+        blendRow(sources, rowStart[j], x0, x1, blendedRow.data());
+        for (int i = 0; i < region.width; i++) {
+            const uchar* pixel = &blendedRow[3 * (columnStart[i] - x0)];
+            out[3 * i] = pixel[0];
+            out[3 * i + 1] = pixel[1];
+            out[3 * i + 2] = pixel[2];
+        }
+    }
+}
+
+/**
+ * Box filtering: every view pixel is the mean of the blended source pixels it covers,
+ * divided by fixed-point multiplication. The source rows of a view row are summed up
+ * per column first, which is vectorized, so that every view pixel only adds the sums
+ * of its columns.
+ */
+template<>
+void
+BlendKernel::resample<BlendKernel::BOX>(const BlendSources& sources, const cv::Rect& region, cv::Mat& view) {
+    const int x0 = columnStart.front();
+    const int x1 = columnEnd.back();
+    blendedRow.resize(3 * (x1 - x0));
+    sums.resize(3 * (x1 - x0));
+
+    int maxColumns = 1;
+    for (int i = 0; i < region.width; i++) {
+        maxColumns = std::max(maxColumns, columnEnd[i] - columnStart[i]);
+    }
+    int maxRows = 1;
+    for (int j = 0; j < region.height; j++) {
+        maxRows = std::max(maxRows, rowEnd[j] - rowStart[j]);
+    }
+    const size_t maxCount = static_cast<size_t>(maxColumns) * maxRows;
+    if (reciprocals.size() <= maxCount) {
+        const size_t first = std::max<size_t>(reciprocals.size(), 1);
+        reciprocals.resize(maxCount + 1);
+        for (size_t count = first; count <= maxCount; count++) {
+            reciprocals[count] = static_cast<uint32_t>(((1u << 16) + count / 2) / count);
+        }
+    }
+
+    for (int j = 0; j < region.height; j++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int y = rowStart[j]; y < rowEnd[j]; y++) {
+            blendRow(sources, y, x0, x1, blendedRow.data());
+            accumulate(blendedRow.data(), sums.data(), static_cast<int>(blendedRow.size()));
+        }
+
+        uchar* out = view.ptr<uchar>(region.y + j) + 3 * region.x;
+        const int rows = rowEnd[j] - rowStart[j];
+        for (int i = 0; i < region.width; i++) {
+            uint32_t b = 0, g = 0, r = 0;
+            for (int x = columnStart[i]; x < columnEnd[i]; x++) {
+                const uint32_t* sum = &sums[3 * (x - x0)];
+                b += sum[0];
+                g += sum[1];
+                r += sum[2];
+            }
+            const uint32_t reciprocal = reciprocals[(columnEnd[i] - columnStart[i]) * rows];
+            out[3 * i] = static_cast<uchar>(std::min<uint32_t>(255, (b * reciprocal + (1u << 15)) >> 16));
+            out[3 * i + 1] = static_cast<uchar>(std::min<uint32_t>(255, (g * reciprocal + (1u << 15)) >> 16));
+            out[3 * i + 2] = static_cast<uchar>(std::min<uint32_t>(255, (r * reciprocal + (1u << 15)) >> 16));
+        }
+    }
+}
+
+void
+BlendKernel::render(const BlendSources& sources, const cv::Rect_<double>& zoomRect, const cv::Rect& region, cv::Mat& view) {
+    if (region.empty() || sources.image.empty()) {
+        return;
+    }
+
+    const double sx = zoomRect.width / static_cast<double>(view.cols);
+    const double sy = zoomRect.height / static_cast<double>(view.rows);
+    // box filtering is only needed if a view pixel covers more than a source pixel
+    const bool zoomedIn = sx <= 1.0 && sy <= 1.0;
+
+    // ranges of source pixels covered by the columns and rows of the region
+    // where the centers of the view pixels are sampled when zoomed in
+    const double epsilon = 1e-6;
+    columnStart.resize(region.width);
+    columnEnd.resize(region.width);
+    for (int i = 0; i < region.width; i++) {
+        const double x = zoomRect.x + (region.x + i) * sx;
+        const int start = zoomedIn ? static_cast<int>(std::floor(x + 0.5 * sx)) : static_cast<int>(std::floor(x + epsilon));
+        columnStart[i] = std::min(std::max(start, 0), sources.image.cols - 1);
+        columnEnd[i] = zoomedIn ? columnStart[i] + 1
+            : std::min(std::max(static_cast<int>(std::ceil(x + sx - epsilon)), columnStart[i] + 1), sources.image.cols);
+    }
+    rowStart.resize(region.height);
+    rowEnd.resize(region.height);
+    for (int j = 0; j < region.height; j++) {
+        const double y = zoomRect.y + (region.y + j) * sy;
+        const int start = zoomedIn ? static_cast<int>(std::floor(y + 0.5 * sy)) : static_cast<int>(std::floor(y + epsilon));
+        rowStart[j] = std::min(std::max(start, 0), sources.image.rows - 1);
+        rowEnd[j] = zoomedIn ? rowStart[j] + 1
+            : std::min(std::max(static_cast<int>(std::ceil(y + sy - epsilon)), rowStart[j] + 1), sources.image.rows);
+    }
+
+    if (zoomedIn) {
+        resample<NEAREST>(sources, region, view);
+    } else {
+        resample<BOX>(sources, region, view);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef BLEND_KERNEL_H
+#define BLEND_KERNEL_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Sources of the blend kernel, all covering the same region of a level of the image.
+ */
+struct BlendSources {
+    // BGR pixels
+    cv::Mat image;
+    // labels of the GT
+    cv::Mat labels;
+    // defect outlines where not 0, may be empty
+    cv::Mat outlines;
+    // weighted color added for every label (see BlendKernel::weightColors)
+    const cv::Vec3b* colors;
+    // color replacing the pixels of outlines
+    cv::Vec3b outlineColor;
+};
+
+/**
+ * Fused kernel which blends the image with its colorized GT and resamples the result
+ * into the view in a single pass, without an intermediate blend at source resolution.
+ *
+ * Every view pixel is computed directly from the sources: nearest neighbor sampling is
+ * used when zoomed in, so that single pixels stay sharp for annotating, and a box filter
+ * over the covered source pixels when zoomed out. Both are separate specializations of
+ * the kernel. Labels are blended by adding their weighted colors with saturation, and
+ * the box filter sums up source rows, both of which use AVX2 or SSE2 if the processor
+ * supports them. The lookup of the label colors and the nearest neighbor sampling gather
+ * 3 byte pixels at arbitrary positions and stay scalar.
+ *
+ * The kernel keeps its scratch rows between calls.
+ */
+class BlendKernel {
+public:
+    /**
+     * Weight the colors of all labels by an overlay factor in percent using 8 bit fixed-point arithmetic.
+     */
+    static void weightColors(const cv::Vec3b* labelColors, int overlay, cv::Vec3b* weighted);
+
+    /**
+     * Render a region of the view (view coordinates). The zoomRect is the region of the
+     * sources (source coordinates) which is displayed in the whole view.
+     */
+    void render(const BlendSources& sources, const cv::Rect_<double>& zoomRect, const cv::Rect& region, cv::Mat& view);
+
+private:
+    enum Sampling { NEAREST, BOX };
+
+    template<Sampling sampling>
+    void resample(const BlendSources& sources, const cv::Rect& region, cv::Mat& view);
+    void blendRow(const BlendSources& sources, int y, int x0, int x1, uchar* out);
+
+    // range of source columns and rows [start, end) sampled by every column and row of the region
+    std::vector<int> columnStart;
+    std::vector<int> columnEnd;
+    std::vector<int> rowStart;
+    std::vector<int> rowEnd;
+
+    // colors of the labels of a row
+    std::vector<uchar> colorRow;
+    // blended source row used by the box filter
+    std::vector<uchar> blendedRow;
+    // sums of the source rows of the box filter for every channel of the source columns
+    std::vector<uint32_t> sums;
+    // fixed-point reciprocals (16 bit fraction) of the number of pixels of a box
+    std::vector<uint32_t> reciprocals;
+};
+
+#endif // BLEND_KERNEL_H
@@ -0,0 +1,141 @@
+#include "brush.h"
+
+#include "simd_dispatch.h"
+
+#include <algorithm>
+
+namespace {
+
+// combines a row of a stamp with a row of a target mask
+typedef void (*BlitRow)(const uchar* stamp, int count, uchar* target);
+
+void
+blit_row_scalar(const uchar* stamp, int count, uchar* target) {
+    for (int i = 0; i < count; i++) {
+        target[i] |= stamp[i];
+    }
+}
+
+#if defined(__SSE2__)
+void
+blit_row_sse2(const uchar* stamp, int count, uchar* target) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i painted = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stamp + i));
+        __m128i* row = reinterpret_cast<__m128i*>(target + i);
+        _mm_storeu_si128(row, _mm_or_si128(_mm_loadu_si128(row), painted));
+    }
+    blit_row_scalar(stamp + i, count - i, target + i);
+}
+#endif
+
+#if defined(SIMD_AVX2)
+__attribute__((target("avx2"))) void
+blit_row_avx2(const uchar* stamp, int count, uchar* target) {
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i painted = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stamp + i));
+        __m256i* row = reinterpret_cast<__m256i*>(target + i);
+        _mm256_storeu_si256(row, _mm256_or_si256(_mm256_loadu_si256(row), painted));
+    }
+    blit_row_scalar(stamp + i, count - i, target + i);
+}
+#endif
+
+// fastest implementation supported by the processor
+const BlitRow blit_row = select_implementation<BlitRow>(
+    SIMD_AVX2_FUNCTION(blit_row_avx2), SIMD_SSE2(blit_row_sse2), blit_row_scalar);
+
+}
+
+bool
+BrushStamp::apply(const cv::Point& position, cv::Mat& target) const {
+    const int x0 = position.x - radius;
+    const int y0 = position.y - radius;
+    const int firstRow = std::max(0, -y0);
+    const int lastRow = std::min(mask.rows, target.rows - y0);
+    bool covered = false;
+    for (int y = firstRow; y < lastRow; y++) {
+        // only the painted columns of the row inside the target are combined
+        const int first = std::max(spans[y][0], -x0);
+        const int last = std::min(spans[y][1], target.cols - x0);
+        if (first < last) {
+            blit_row(mask.ptr<uchar>(y) + first, last - first, target.ptr<uchar>(y0 + y) + x0 + first);
+            covered = true;
+        }
+    }
+    return covered;
+}
+
+Brush::Brush()
+    : currentShape(SQUARE) {}
+
+bool
+Brush::setShape(const std::string& shape) {
+    if (shape == "square") {
+        currentShape = SQUARE;
+        return true;
+    }
+    if (shape == "circle") {
+        currentShape = CIRCLE;
+        return true;
+    }
+    bitmap = cv::imread(shape, cv::IMREAD_GRAYSCALE);
+    if (bitmap.empty()) {
+        return false;
+    }
+    currentShape = BITMAP;
+    // stamps of a previous image are outdated
+    stamps.clear();
+    return true;
+}
+
+const BrushStamp&
+Brush::stamp(int radius) {
+    radius = std::max(radius, 0);
+    const std::pair<Shape, int> key(currentShape, radius);
+    std::map<std::pair<Shape, int>, BrushStamp>::iterator it = stamps.find(key);
+    if (it == stamps.end()) {
+        it = stamps.insert(std::make_pair(key, BrushStamp())).first;
+        rasterize(currentShape, radius, it->second);
+    }
+    return it->second;
+}
+
+/**
+ * Rasterize the stamp of a shape with a radius.
+ */
+void
+Brush::rasterize(Shape shape, int radius, BrushStamp& stamp) const {
+    const int length = 2 * radius + 1;
+    stamp.radius = radius;
+    stamp.mask = cv::Mat::zeros(length, length, CV_8UC1);
+    switch (shape) {
+        case SQUARE:
+            stamp.mask.setTo(255);
+            break;
+        case CIRCLE:
+            cv::circle(stamp.mask, cv::Point(radius, radius), radius, cv::Scalar(255), cv::FILLED);
+            break;
+        case BITMAP:
+            cv::resize(bitmap, stamp.mask, stamp.mask.size(), 0, 0, cv::INTER_AREA);
+            cv::threshold(stamp.mask, stamp.mask, 127, 255, cv::THRESH_BINARY);
+            break;
+    }
+
+    // pixels between the first and the last painted pixel of a row which are not painted
+    // are combined as well, which keeps them unchanged
+    stamp.spans.assign(length, cv::Vec2i(0, 0));
+    for (int y = 0; y < length; y++) {
+        const uchar* row = stamp.mask.ptr<uchar>(y);
+        int first = 0;
+        while (first < length && !row[first]) {
+            first++;
+        }
+        int last = length;
+        while (last > first && !row[last - 1]) {
+            last--;
+        }
+        stamp.spans[y] = cv::Vec2i(first, last);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef BRUSH_H
+#define BRUSH_H
+
+#include <opencv2/opencv.hpp>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Mask of the pixels painted by a brush of a certain shape and radius.
+ *
+ * The stamp is a square of 2 * radius + 1 pixels centered on the cursor. For
+ * every row the columns covered by the brush are stored as well, so that only
+ * those are touched when the stamp is applied.
+ */
+struct BrushStamp {
+    // 255 where the brush paints, 0 elsewhere
+    cv::Mat mask;
+    // first and one past the last column of every row painted by the brush
+    std::vector<cv::Vec2i> spans;
+    int radius;
+
+    /**
+     * Region covered by the stamp relative to the cursor.
+     */
+    cv::Rect bounds() const { return cv::Rect(-radius, -radius, 2 * radius + 1, 2 * radius + 1); }
+
+    /**
+     * Paint the stamp centered on a position of a target mask by setting the covered
+     * pixels to 255. The stamp is clipped to the target. Returns false if the painted
+     * columns of the stamp are all outside of the target.
+     */
+    bool apply(const cv::Point& position, cv::Mat& target) const;
+};
+
+/**
+ * Shape of the brush painting the GT together with its stamps.
+ *
+ * The stamps are rasterized once for every radius they are used with and cached,
+ * so that painting costs the same for every shape. Stamps stay valid as long as
+ * the brush exists.
+ */
+class Brush {
+public:
+    enum Shape {
+        SQUARE,
+        CIRCLE,
+        // image given by the user, scaled to the size of the stamp
+        BITMAP
+    };
+
+    Brush();
+
+    /**
+     * Use a square, a circle or an image as brush. The pixels of the image brighter
+     * than 127 are painted. Returns false if the image could not be read.
+     */
+    bool setShape(const std::string& shape);
+
+    Shape shape() const { return currentShape; }
+
+    /**
+     * Stamp of the current shape with the given radius.
+     */
+    const BrushStamp& stamp(int radius);
+
+private:
+    void rasterize(Shape shape, int radius, BrushStamp& stamp) const;
+
+    Shape currentShape;
+    // image of a brush given by the user
+    cv::Mat bitmap;
+    // stamps already rasterized for a shape and a radius
+    std::map<std::pair<Shape, int>, BrushStamp> stamps;
+};
+
+#endif // BRUSH_H
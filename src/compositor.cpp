@@ -0,0 +1,299 @@
+#include "compositor.h"
+
+#include "geometry.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// coarsest level of the image pyramid
+const int MAX_LEVEL = 16;
+// smaller regions are rendered by a single thread as waking up the pool costs more than it saves
+const int MIN_PARALLEL_PIXELS = 64 * 1024;
+// bands per thread, more bands balance the load better between the threads
+const size_t BANDS_PER_THREAD = 2;
+
+/**
+ * Rows of the band of a region split into a number of bands of similar height.
+ */
+cv::Rect
+band(const cv::Rect& region, size_t bands, size_t index) {
+    const int y0 = region.y + static_cast<int>(region.height * index / bands);
+    const int y1 = region.y + static_cast<int>(region.height * (index + 1) / bands);
+    return cv::Rect(region.x, y0, region.width, y1 - y0);
+}
+
+/**
+ * Task reading a band of a region of a level of the image.
+ */
+struct ReadBand {
+    TiledImage* image;
+    int level;
+    cv::Rect region;
+    cv::Point origin;
+    cv::Mat* source;
+    size_t bands;
+
+    void operator()(size_t index) const {
+        const cv::Rect part = band(region, bands, index);
+        if (!part.empty()) {
+            cv::Mat sourcePart = (*source)(part - origin);
+            image->read(level, part, sourcePart);
+        }
+    }
+};
+
+/**
+ * Task blending a band of a region of the view.
+ */
+struct BlendBand {
+    std::vector<BlendKernel>* kernels;
+    const BlendSources* sources;
+    cv::Rect_<double> zoomRect;
+    cv::Rect region;
+    cv::Mat* view;
+
+    void operator()(size_t index) const {
+        const cv::Rect part = band(region, kernels->size(), index);
+        if (!part.empty()) {
+            (*kernels)[index].render(*sources, zoomRect, part, *view);
+        }
+    }
+};
+
+}
+
+Compositor::Compositor(unsigned threads, bool pinThreads, std::function<void()> setupThread)
+    : pool(threads, pinThreads, setupThread), kernels(pool.size() * BANDS_PER_THREAD) {
+    // by default labels are displayed as gray values so that the GT appears white
+    for (int label = 0; label < 256; label++) {
+        labelColors[label] = cv::Vec3b(label, label, label);
+    }
+    reset();
+}
+
+void
+Compositor::reset() {
+    dirty = cv::Rect();
+    dirtyAll = true;
+    blendRect = cv::Rect();
+    lastOverlay = -1;
+    lastDefects = nullptr;
+    lastLevel = -1;
+    defectLayers.clear();
+    layerDefects = nullptr;
+    markerRect = cv::Rect();
+}
+
+void
+Compositor::invalidate(const cv::Rect& region) {
+    dirty = unite(dirty, region);
+}
+
+cv::Mat
+Compositor::render(TiledImage& image, TiledGT& imageGT, const cv::Rect& zoomRect, const cv::Size& viewSize,
+                   int overlay, const std::vector<cv::Rect>* defects, const cv::Rect& marker) {
+    // (re-)allocate the view if the window was resized
+    if (view.size() != viewSize) {
+        view = viewBuffer.resize(viewSize, CV_8UC3);
+        dirtyAll = true;
+        markerRect = cv::Rect();
+    }
+
+    // the marker is drawn directly into the view so remove it first
+    restoreMarker();
+
+    // the view is sampled from the coarsest level of the pyramid which is still at least as fine as the view
+    const double scale = std::min(zoomRect.width / static_cast<double>(viewSize.width),
+                                  zoomRect.height / static_cast<double>(viewSize.height));
+    int level = 0;
+    while (level < MAX_LEVEL && (2 << level) <= scale) {
+        level++;
+    }
+    const cv::Size levelSize = image.size(level);
+    if (level != lastLevel) {
+        dirtyAll = true;
+    }
+
+    // zooming rectangle in coordinates of the level
+    const double factor = 1.0 / (1 << level);
+    const cv::Rect_<double> levelZoom(zoomRect.x * factor, zoomRect.y * factor,
+                                      zoomRect.width * factor, zoomRect.height * factor);
+
+    // only the viewport is blended, including a border of one pixel
+    // needed by the interpolation when zooming
+    const int x0 = static_cast<int>(std::floor(levelZoom.x)) - 1;
+    const int y0 = static_cast<int>(std::floor(levelZoom.y)) - 1;
+    const int x1 = static_cast<int>(std::ceil(levelZoom.x + levelZoom.width)) + 1;
+    const int y1 = static_cast<int>(std::ceil(levelZoom.y + levelZoom.height)) + 1;
+    const cv::Rect viewport = cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, levelSize.width, levelSize.height);
+    if (viewport != blendRect) {
+        blendRect = viewport;
+        imageSource = imageBuffer.resize(blendRect.size(), CV_8UC3);
+        gtSource = gtBuffer.resize(blendRect.size(), CV_8UC1);
+        outlineSource = outlineBuffer.resize(blendRect.size(), CV_8UC1);
+        dirtyAll = true;
+    }
+    // decode the tiles around the viewport before they are needed for panning
+    image.prefetch(level, viewport);
+
+    // changing the overlay or the defects affects the whole view
+    if (overlay != lastOverlay) {
+        BlendKernel::weightColors(labelColors, overlay, overlayColors);
+        dirtyAll = true;
+    }
+    if (defects != lastDefects) {
+        dirtyAll = true;
+    }
+    DefectLayer* defectLayer = nullptr;
+    if (defects) {
+        // the layers of all levels are built again for other defects
+        if (defects != layerDefects) {
+            defectLayers.clear();
+            layerDefects = defects;
+        }
+        if (static_cast<int>(defectLayers.size()) <= level) {
+            defectLayers.resize(level + 1);
+        }
+        defectLayer = &defectLayers[level];
+        if (!defectLayer->built()) {
+            defectLayer->build(*defects, levelSize, level);
+        }
+    }
+
+    // the modified regions of the image are mapped to the level
+    cv::Rect region = dirtyAll ? blendRect : to_level(dirty, level) & blendRect;
+    if (!region.empty()) {
+        updateSources(image, imageGT, level, defectLayer, region);
+    }
+
+    // blend and resample the view again where the sources changed
+    BlendSources blendSources;
+    blendSources.image = imageSource;
+    blendSources.labels = gtSource;
+    blendSources.outlines = defectLayer ? outlineSource : cv::Mat();
+    blendSources.colors = overlayColors;
+    blendSources.outlineColor = cv::Vec3b(255, 0, 0);
+    const cv::Rect_<double> sourceZoom(levelZoom.x - blendRect.x, levelZoom.y - blendRect.y,
+                                       levelZoom.width, levelZoom.height);
+    if (dirtyAll) {
+        blend(blendSources, sourceZoom, cv::Rect(0, 0, view.cols, view.rows));
+    } else if (!region.empty()) {
+        blend(blendSources, sourceZoom, viewRegion(levelZoom, region));
+    }
+
+    dirty = cv::Rect();
+    dirtyAll = false;
+    lastOverlay = overlay;
+    lastDefects = defects;
+    lastLevel = level;
+
+    saveMarker(marker);
+    cv::rectangle(view, marker.tl(), marker.br(), cv::Scalar(0, 0, 0), 1);
+
+    return view;
+}
+
+/**
+ * Copy a region of a level of the image (level coordinates) and its GT into the sources
+ * of the viewport and draw the outlines of the defects reaching into that region.
+ * The image is only copied again if the whole viewport changed.
+ */
+void
+Compositor::updateSources(TiledImage& image, TiledGT& imageGT, int level,
+                          DefectLayer* defectLayer, const cv::Rect& region) {
+    const cv::Rect part = region - blendRect.tl();
+    if (dirtyAll) {
+        readImage(image, level, region);
+    }
+
+    // regions without allocated GT tiles only contain the label 0
+    cv::Mat gtPart = gtSource(part);
+    if (imageGT.labeled(level, region)) {
+        imageGT.read(level, region, gtPart);
+    } else {
+        gtPart.setTo(0);
+    }
+
+    if (defectLayer && dirtyAll) {
+        cv::Mat outlinePart = outlineSource(part);
+        outlinePart.setTo(0);
+        defectLayer->draw(outlinePart, region, cv::Scalar(255));
+    }
+}
+
+/**
+ * Read a region of a level of the image (level coordinates) into the image source,
+ * in bands on the pool if the region is large.
+ */
+void
+Compositor::readImage(TiledImage& image, int level, const cv::Rect& region) {
+    const bool parallel = region.area() >= MIN_PARALLEL_PIXELS;
+    ReadBand task = { &image, level, region, blendRect.tl(), &imageSource, parallel ? pool.size() : 1 };
+    pool.run(task.bands, task);
+}
+
+/**
+ * Blend and resample a region of the view from the sources,
+ * in bands on the pool if the region is large.
+ */
+void
+Compositor::blend(const BlendSources& sources, const cv::Rect_<double>& zoomRect, const cv::Rect& region) {
+    if (region.area() < MIN_PARALLEL_PIXELS) {
+        kernels[0].render(sources, zoomRect, region, view);
+        return;
+    }
+    BlendBand task = { &kernels, &sources, zoomRect, region, &view };
+    pool.run(kernels.size(), task);
+}
+
+/**
+ * Compute the region of the view which is affected by a region of the sources.
+ * Pixels next to the region are included so that the box filter is covered.
+ */
+cv::Rect
+Compositor::viewRegion(const cv::Rect_<double>& zoomRect, const cv::Rect& region) const {
+    const double sx = zoomRect.width / static_cast<double>(view.cols);
+    const double sy = zoomRect.height / static_cast<double>(view.rows);
+
+    int x0 = static_cast<int>(std::floor((region.x - 1 - zoomRect.x + 0.5) / sx - 0.5));
+    int y0 = static_cast<int>(std::floor((region.y - 1 - zoomRect.y + 0.5) / sy - 0.5));
+    int x1 = static_cast<int>(std::ceil((region.x + region.width - zoomRect.x + 0.5) / sx - 0.5)) + 1;
+    int y1 = static_cast<int>(std::ceil((region.y + region.height - zoomRect.y + 0.5) / sy - 0.5)) + 1;
+
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, view.cols);
+    y1 = std::min(y1, view.rows);
+    if (x1 <= x0 || y1 <= y0) {
+        return cv::Rect();
+    }
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * Save the content of the view which will be covered by the marker.
+ */
+void
+Compositor::saveMarker(const cv::Rect& marker) {
+    // the marker outline includes its bottom right corner
+    markerRect = cv::Rect(marker.x, marker.y, marker.width + 1, marker.height + 1) & cv::Rect(0, 0, view.cols, view.rows);
+    if (!markerRect.empty()) {
+        underMarker = markerBuffer.resize(markerRect.size(), CV_8UC3);
+        view(markerRect).copyTo(underMarker);
+    }
+}
+
+/**
+ * Restore the content of the view below the last drawn marker.
+ */
+void
+Compositor::restoreMarker() {
+    if (markerRect.empty()) {
+        return;
+    }
+    cv::Mat viewRegion = view(markerRect);
+    underMarker.copyTo(viewRegion);
+    markerRect = cv::Rect();
+}
@@ -0,0 +1,131 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <opencv2/opencv.hpp>
+
+#include "blend_kernel.h"
+#include "defect_layer.h"
+#include "frame_buffer.h"
+#include "pyramid.h"
+#include "thread_pool.h"
+#include "tiled_gt.h"
+#include "tiled_image.h"
+
+#include <functional>
+#include <vector>
+
+/**
+ * Incremental renderer for the annotation view.
+ *
+ * The blend between the image and its GT is only computed for the pixels inside
+ * the zooming rectangle so that the cost of a frame scales with the viewport and
+ * not with the image. The pixels of the viewport and the view are kept between
+ * frames and the view is blended and resampled from them in a single pass (see
+ * BlendKernel). Only regions that were modified since the last frame (see
+ * invalidate) are rendered again. Changes of the zooming rectangle, the overlay
+ * factor or the displayed defects lead to a complete re-render of the view.
+ *
+ * The GT is a single channel label image which is colorized through a lookup
+ * table while blending, so that no colored GT is ever stored.
+ *
+ * The outlines of the defects are taken from a cached layer which is built once
+ * per image (see DefectLayer), so that only the defects near the blended region
+ * are considered and each of them is rasterized only once.
+ *
+ * When zoomed out the view is not sampled from the image itself but from the level
+ * of the image pyramid closest to the scale of the view, so that the cost of a frame
+ * does not grow with the zoom and fine structures do not alias.
+ *
+ * The image and the GT are read in tiles (see TiledImage and TiledGT), only the tiles
+ * of the viewport are touched and the tiles around it are decoded ahead of time.
+ *
+ * All buffers of a frame are reused (see FrameBuffer), so that rendering does not
+ * allocate once the window and the viewport reached their size.
+ *
+ * Large regions of the view are blended in horizontal bands on a pool of threads
+ * (see ThreadPool), every band with its own BlendKernel so that the bands share no
+ * scratch memory. The image is read into the viewport in bands as well.
+ */
+class Compositor {
+public:
+    /**
+     * Use the given number of threads for rendering, or one per core if threads is 0.
+     * The threads are pinned to cores if pinThreads is set and call setupThread when
+     * they start (see ThreadPool).
+     */
+    explicit Compositor(unsigned threads = 0, bool pinThreads = false, std::function<void()> setupThread = nullptr);
+
+    /**
+     * Forget everything rendered so far, e.g. because a new image is displayed.
+     */
+    void reset();
+
+    /**
+     * Mark a region of the GT, given in image coordinates, as modified.
+     */
+    void invalidate(const cv::Rect& region);
+
+    /**
+     * Render the zoomRect of the blend between an image and its GT into a view of the given size,
+     * usually the size of the window, so that it is resampled only once.
+     * The marker rectangle is given in view coordinates and drawn on top of the view.
+     * The returned frame is owned by the compositor and valid until the next call.
+     */
+    cv::Mat render(TiledImage& image, TiledGT& imageGT, const cv::Rect& zoomRect, const cv::Size& viewSize,
+                   int overlay, const std::vector<cv::Rect>* defects, const cv::Rect& marker);
+
+private:
+    void updateSources(TiledImage& image, TiledGT& imageGT, int level,
+                       DefectLayer* defectLayer, const cv::Rect& region);
+    cv::Rect viewRegion(const cv::Rect_<double>& zoomRect, const cv::Rect& region) const;
+    void readImage(TiledImage& image, int level, const cv::Rect& region);
+    void blend(const BlendSources& sources, const cv::Rect_<double>& zoomRect, const cv::Rect& region);
+
+    void saveMarker(const cv::Rect& marker);
+    void restoreMarker();
+
+    // pixels of the image, the GT and the defect outlines of the viewport
+    // at the resolution of a level of the pyramid
+    cv::Mat imageSource;
+    cv::Mat gtSource;
+    cv::Mat outlineSource;
+    FrameBuffer imageBuffer;
+    FrameBuffer gtBuffer;
+    FrameBuffer outlineBuffer;
+    // region of the level covered by the sources
+    cv::Rect blendRect;
+    // zoomed view onto the blend at the resolution of the window
+    cv::Mat view;
+    FrameBuffer viewBuffer;
+    // renders the bands of large regions in parallel
+    ThreadPool pool;
+    // blends and resamples the sources into the view, one for every band
+    std::vector<BlendKernel> kernels;
+
+    // region of the GT which has to be rendered again (image coordinates)
+    cv::Rect dirty;
+    // if everything has to be rendered again
+    bool dirtyAll;
+
+    // color of every label value
+    cv::Vec3b labelColors[256];
+    // color of every label value weighted by the overlay factor
+    cv::Vec3b overlayColors[256];
+
+    // parameters of the last frame used to detect changes
+    int lastOverlay;
+    const std::vector<cv::Rect>* lastDefects;
+    int lastLevel;
+
+    // outlines of the defects for every level of the pyramid, kept while they are hidden
+    std::vector<DefectLayer> defectLayers;
+    // defects the layer was built from
+    const std::vector<cv::Rect>* layerDefects;
+
+    // content of the view below the marker so that it can be restored
+    cv::Rect markerRect;
+    cv::Mat underMarker;
+    FrameBuffer markerBuffer;
+};
+
+#endif // COMPOSITOR_H
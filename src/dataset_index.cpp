@@ -0,0 +1,259 @@
+#include "dataset_index.h"
+
+#include <boost/filesystem.hpp>
+
+#include "tiled_image.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// first line of an index file followed by the version of the format
+const std::string INDEX_HEADER = "pixelwise-annotation-index 1";
+
+/**
+ * List the names of all files and tiled image directories in a directory.
+ */
+std::vector<std::string>
+list_files(const std::string& dir) {
+    std::vector<std::string> files;
+    fs::directory_iterator end_itr;
+    for (fs::directory_iterator itr(dir); itr != end_itr; itr++) {
+        // skip directories except tiled images
+        if (fs::is_directory(itr->status()) && !is_tiled(itr->path().string())) {
+            continue;
+        }
+        files.push_back(itr->path().filename().string());
+    }
+    return files;
+}
+
+}
+
+DatasetIndex::DatasetIndex(const std::string& imageDir, const std::string& outputDir, const NameRule& nameRule)
+    : imageDir(imageDir), outputDir(outputDir), indexFile(outputDir + "/.index.txt"), nameRule(nameRule),
+      imageDirTime(0), outputDirTime(0), writeTime(0) {
+}
+
+void
+DatasetIndex::load() {
+    const bool loaded = read();
+    if (!loaded) {
+        clear();
+    }
+
+    // directories modified in the same second as the index was written are listed again
+    // because their modification could have happened after writing it
+    const std::time_t imageTime = fs::last_write_time(imageDir);
+    const bool listed = !loaded || imageTime != imageDirTime || imageTime >= writeTime;
+    if (listed) {
+        list();
+        imageDirTime = imageTime;
+    }
+
+    const std::time_t outputTime = fs::last_write_time(outputDir);
+    if (listed || outputTime != outputDirTime || outputTime >= writeTime) {
+        refreshGtExists();
+        outputDirTime = outputTime;
+    }
+
+    buildLookup();
+}
+
+bool
+DatasetIndex::save() const {
+    const std::string temporary = indexFile + ".tmp";
+    std::ofstream out(temporary);
+    out << INDEX_HEADER << "\n";
+    out << imageDir << "\n";
+    out << imageDirTime << " " << outputDirTime << " " << std::time(nullptr) << "\n";
+    for (size_t i = 0; i < files.size(); i++) {
+        out << gtExists(i) << annotated(i) << "\t" << files[i] << "\n";
+    }
+    out.close();
+
+    // replace the index atomically
+    if (!out || std::rename(temporary.c_str(), indexFile.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string
+DatasetIndex::imagePath(size_t i) const {
+    return imagePathOf(files[i]);
+}
+
+std::string
+DatasetIndex::gtPath(size_t i) const {
+    return outputDir + "/" + files[i];
+}
+
+size_t
+DatasetIndex::find(const std::string& name) const {
+    const uint32_t id = names.find(name);
+    return id == ImageNames::NONE ? files.size() : firstByName[id];
+}
+
+size_t
+DatasetIndex::nextUnannotated(size_t i) {
+    if (i >= files.size()) {
+        return files.size();
+    }
+
+    size_t root = i;
+    while (next[root] != root) {
+        root = next[root];
+    }
+    // compress the path so that following queries are answered directly
+    while (next[i] != root) {
+        size_t following = next[i];
+        next[i] = root;
+        i = following;
+    }
+    return root;
+}
+
+void
+DatasetIndex::setAnnotated(const std::unordered_set<std::string>& annotatedNames) {
+    // the names are looked up once and then compared by their IDs
+    std::vector<char> annotatedNameIds(names.size(), 0);
+    for (const std::string& name : annotatedNames) {
+        const uint32_t id = names.find(name);
+        if (id != ImageNames::NONE) {
+            annotatedNameIds[id] = 1;
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        annotatedFlags[i] = annotatedNameIds[nameIds[i]];
+    }
+    buildLookup();
+}
+
+void
+DatasetIndex::setAnnotated(size_t i) {
+    annotatedFlags[i] = 1;
+    next[i] = i + 1;
+}
+
+void
+DatasetIndex::setGtExists(size_t i) {
+    gtFlags[i] = 1;
+}
+
+/**
+ * Read the index file. Returns false if it does not exist, is damaged or
+ * belongs to another image directory.
+ */
+bool
+DatasetIndex::read() {
+    std::ifstream in(indexFile);
+    std::string header, dir;
+    if (!std::getline(in, header) || header != INDEX_HEADER || !std::getline(in, dir) || dir != imageDir) {
+        return false;
+    }
+
+    std::string times;
+    if (!std::getline(in, times) || !(std::istringstream(times) >> imageDirTime >> outputDirTime >> writeTime)) {
+        return false;
+    }
+
+    clear();
+    for (std::string line; std::getline(in, line); ) {
+        if (line.size() < 4 || line[2] != '\t') {
+            return false;
+        }
+        append(line.substr(3), line[0] == '1', line[1] == '1');
+    }
+    return true;
+}
+
+/**
+ * List the image directory again. Known images keep their position and new
+ * images are appended in the order of the directory listing.
+ */
+void
+DatasetIndex::list() {
+    std::vector<std::string> listed = list_files(imageDir);
+    std::unordered_set<std::string> present(listed.begin(), listed.end());
+
+    std::vector<std::string> knownFiles;
+    std::vector<char> knownGtFlags, knownAnnotatedFlags;
+    knownFiles.swap(files);
+    knownGtFlags.swap(gtFlags);
+    knownAnnotatedFlags.swap(annotatedFlags);
+    clear();
+
+    std::unordered_set<std::string> known;
+    for (size_t i = 0; i < knownFiles.size(); i++) {
+        if (present.count(knownFiles[i])) {
+            append(knownFiles[i], knownGtFlags[i] != 0, knownAnnotatedFlags[i] != 0);
+            known.insert(knownFiles[i]);
+        }
+    }
+    for (const std::string& file : listed) {
+        if (!known.count(file)) {
+            append(file, false, false);
+        }
+    }
+}
+
+/**
+ * Refresh if GTs exist by listing the output directory once.
+ */
+void
+DatasetIndex::refreshGtExists() {
+    std::vector<std::string> gtFiles = list_files(outputDir);
+    std::unordered_set<std::string> gts(gtFiles.begin(), gtFiles.end());
+    for (size_t i = 0; i < files.size(); i++) {
+        gtFlags[i] = gts.count(files[i]) > 0;
+    }
+}
+
+/**
+ * Build the lookup of images by name and the links to images which are not annotated.
+ */
+void
+DatasetIndex::buildLookup() {
+    // the first image with a name is found
+    firstByName.assign(names.size(), files.size());
+    next.resize(files.size() + 1);
+    for (size_t i = files.size(); i-- > 0; ) {
+        firstByName[nameIds[i]] = i;
+        next[i] = annotatedFlags[i] ? i + 1 : i;
+    }
+    next[files.size()] = files.size();
+}
+
+/**
+ * Remove all images.
+ */
+void
+DatasetIndex::clear() {
+    files.clear();
+    nameIds.clear();
+    gtFlags.clear();
+    annotatedFlags.clear();
+    names.clear();
+}
+
+/**
+ * Append an image and intern its name.
+ */
+void
+DatasetIndex::append(const std::string& file, bool gtExists, bool annotated) {
+    files.push_back(file);
+    nameIds.push_back(names.intern(nameRule(imagePathOf(file))));
+    gtFlags.push_back(gtExists);
+    annotatedFlags.push_back(annotated);
+}
+
+std::string
+DatasetIndex::imagePathOf(const std::string& file) const {
+    return (fs::path(imageDir) / file).string();
+}
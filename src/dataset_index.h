@@ -0,0 +1,111 @@
+#ifndef DATASET_INDEX_H
+#define DATASET_INDEX_H
+
+#include "image_names.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Persistent index of the images to annotate.
+ *
+ * For every image file it stores the name of the image, if a GT exists and if the
+ * image was already annotated, so that navigating (e.g. skipping to an image or to
+ * the next image which is not annotated) never requires to decode images.
+ * The index is stored in the output directory and only refreshed where the
+ * directories changed since it was written: the image directory is only listed
+ * again if it was modified and existing entries keep their order, so that indices
+ * stay stable across sessions. GT existence is refreshed by a single listing of
+ * the output directory instead of checking every file.
+ *
+ * The names of the images are interned when the index is loaded and all data of an
+ * image is kept in flat vectors, so that navigating compares no strings.
+ */
+class DatasetIndex {
+public:
+    DatasetIndex(const std::string& imageDir, const std::string& outputDir, const NameRule& nameRule);
+
+    /**
+     * Load the index from the output directory and refresh it or build it
+     * if it does not exist yet.
+     */
+    void load();
+
+    /**
+     * Write the index to the output directory.
+     */
+    bool save() const;
+
+    size_t size() const { return files.size(); }
+
+    // file name inside the image directory
+    const std::string& file(size_t i) const { return files[i]; }
+    uint32_t nameId(size_t i) const { return nameIds[i]; }
+    const std::string& name(size_t i) const { return names[nameIds[i]]; }
+    bool gtExists(size_t i) const { return gtFlags[i] != 0; }
+    bool annotated(size_t i) const { return annotatedFlags[i] != 0; }
+
+    /**
+     * Interned names of all images. They do not change until the index is loaded again.
+     */
+    const ImageNames& imageNames() const { return names; }
+
+    std::string imagePath(size_t i) const;
+    std::string gtPath(size_t i) const;
+
+    /**
+     * Find the index of an image by its name. Returns size() if there is none.
+     */
+    size_t find(const std::string& name) const;
+
+    /**
+     * Find the first image starting at index i which is not annotated.
+     * Returns size() if there is none.
+     */
+    size_t nextUnannotated(size_t i);
+
+    /**
+     * Set the annotated state of all images from the names of annotated images.
+     */
+    void setAnnotated(const std::unordered_set<std::string>& annotatedNames);
+    void setAnnotated(size_t i);
+    void setGtExists(size_t i);
+
+private:
+    bool read();
+    void list();
+    void refreshGtExists();
+    void buildLookup();
+    void clear();
+    void append(const std::string& file, bool gtExists, bool annotated);
+    std::string imagePathOf(const std::string& file) const;
+
+    std::string imageDir;
+    std::string outputDir;
+    std::string indexFile;
+    NameRule nameRule;
+
+    // data of the images by index
+    std::vector<std::string> files;
+    std::vector<uint32_t> nameIds;
+    std::vector<char> gtFlags;
+    std::vector<char> annotatedFlags;
+
+    ImageNames names;
+    // index of the first image with a name by the ID of the name
+    std::vector<size_t> firstByName;
+    // next[i] leads to the next image which is not annotated, path compressed
+    std::vector<size_t> next;
+
+    // modification times of the directories when they were listed
+    std::time_t imageDirTime;
+    std::time_t outputDirTime;
+    // time the index was written, changes in the same second are not detectable
+    std::time_t writeTime;
+};
+
+#endif // DATASET_INDEX_H
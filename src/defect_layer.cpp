@@ -0,0 +1,110 @@
+#include "defect_layer.h"
+
+#include <algorithm>
+
+namespace {
+
+// thickness of the rectangles marking defects
+const int DEFECT_THICKNESS = 2;
+// width and height of a cell of the grid
+const int CELL_SIZE = 256;
+
+}
+
+DefectLayer::DefectLayer()
+    : isBuilt(false), columns(0), rows(0) {
+}
+
+void
+DefectLayer::build(const std::vector<cv::Rect>& defects, const cv::Size& levelSize, int level) {
+    clear();
+    isBuilt = true;
+    imageSize = levelSize;
+    this->defects.reserve(defects.size());
+    for (const cv::Rect& r : defects) {
+        // the scaled defect covers every pixel of the level its pixels fall into
+        const int x0 = r.x >> level;
+        const int y0 = r.y >> level;
+        const int x1 = ((r.x + std::max(r.width, 1) - 1) >> level) + 1;
+        const int y1 = ((r.y + std::max(r.height, 1) - 1) >> level) + 1;
+        this->defects.push_back(level == 0 ? r : cv::Rect(x0, y0, x1 - x0, y1 - y0));
+    }
+
+    columns = (imageSize.width + CELL_SIZE - 1) / CELL_SIZE;
+    rows = (imageSize.height + CELL_SIZE - 1) / CELL_SIZE;
+    cells.resize(columns * rows);
+    masks.resize(columns * rows);
+
+    const cv::Rect imageRect(0, 0, imageSize.width, imageSize.height);
+    for (size_t i = 0; i < this->defects.size(); i++) {
+        const cv::Rect& r = this->defects[i];
+        // defects are drawn with a thickness and may reach into neighbouring cells
+        const cv::Rect bounds = cv::Rect(r.x - DEFECT_THICKNESS, r.y - DEFECT_THICKNESS,
+                                         r.width + 2 * DEFECT_THICKNESS + 1, r.height + 2 * DEFECT_THICKNESS + 1) & imageRect;
+        if (bounds.empty()) {
+            continue;
+        }
+        for (int row = bounds.y / CELL_SIZE; row <= (bounds.y + bounds.height - 1) / CELL_SIZE; row++) {
+            for (int column = bounds.x / CELL_SIZE; column <= (bounds.x + bounds.width - 1) / CELL_SIZE; column++) {
+                cells[row * columns + column].push_back(static_cast<int>(i));
+            }
+        }
+    }
+}
+
+void
+DefectLayer::clear() {
+    isBuilt = false;
+    defects.clear();
+    cells.clear();
+    masks.clear();
+    columns = 0;
+    rows = 0;
+}
+
+void
+DefectLayer::draw(cv::Mat& target, const cv::Rect& region, const cv::Scalar& color) {
+    const cv::Rect clipped = region & cv::Rect(0, 0, imageSize.width, imageSize.height);
+    if (cells.empty() || clipped.empty()) {
+        return;
+    }
+
+    for (int row = clipped.y / CELL_SIZE; row <= (clipped.y + clipped.height - 1) / CELL_SIZE; row++) {
+        for (int column = clipped.x / CELL_SIZE; column <= (clipped.x + clipped.width - 1) / CELL_SIZE; column++) {
+            const size_t cell = row * columns + column;
+            if (cells[cell].empty()) {
+                continue;
+            }
+            if (masks[cell].empty()) {
+                rasterize(cell);
+            }
+
+            const cv::Rect bounds = cellRect(column, row);
+            const cv::Rect part = bounds & clipped;
+            cv::Mat targetPart = target(part - region.tl());
+            targetPart.setTo(color, masks[cell](part - bounds.tl()));
+        }
+    }
+}
+
+/**
+ * Compute the region of the image covered by a cell.
+ */
+cv::Rect
+DefectLayer::cellRect(int column, int row) const {
+    return cv::Rect(column * CELL_SIZE, row * CELL_SIZE, CELL_SIZE, CELL_SIZE)
+        & cv::Rect(0, 0, imageSize.width, imageSize.height);
+}
+
+/**
+ * Rasterize the outlines of all defects reaching into a cell into its mask.
+ */
+void
+DefectLayer::rasterize(size_t cell) {
+    const cv::Rect bounds = cellRect(static_cast<int>(cell % columns), static_cast<int>(cell / columns));
+    masks[cell] = cv::Mat(bounds.size(), CV_8UC1, cv::Scalar(0));
+    for (int i : cells[cell]) {
+        // drawing into the mask of the cell clips the rectangle to the cell
+        cv::rectangle(masks[cell], defects[i] - bounds.tl(), cv::Scalar(255), DEFECT_THICKNESS);
+    }
+}
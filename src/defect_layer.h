@@ -0,0 +1,60 @@
+#ifndef DEFECT_LAYER_H
+#define DEFECT_LAYER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+/**
+ * Cached overlay layer of the outlines of the defects of an image.
+ *
+ * The defects are stored in a uniform grid over the image, so that drawing a region
+ * only touches the defects whose outlines reach into the cells covering the region,
+ * independent of the number of defects of the image. The outlines of a cell are
+ * rasterized into a mask once, the first time the cell is drawn, and reused until
+ * the layer is built again. Cells without defects have no mask.
+ *
+ * A layer may be built for a level of the image pyramid, in which case the defects
+ * are scaled to the level but keep their thickness in pixels of the level, so that
+ * they stay visible when zoomed out.
+ */
+class DefectLayer {
+public:
+    DefectLayer();
+
+    /**
+     * Index the defects of an image for a level of the image pyramid with the given size.
+     * Nothing is rasterized yet.
+     */
+    void build(const std::vector<cv::Rect>& defects, const cv::Size& levelSize, int level = 0);
+
+    bool built() const { return isBuilt; }
+
+    /**
+     * Forget all defects and rasterized outlines.
+     */
+    void clear();
+
+    /**
+     * Draw the outlines of the defects in a region (image coordinates)
+     * onto the target which covers exactly that region.
+     */
+    void draw(cv::Mat& target, const cv::Rect& region, const cv::Scalar& color);
+
+private:
+    cv::Rect cellRect(int column, int row) const;
+    void rasterize(size_t cell);
+
+    bool isBuilt;
+    // defects in coordinates of the level
+    std::vector<cv::Rect> defects;
+    cv::Size imageSize;
+    int columns;
+    int rows;
+    // indices of the defects whose outlines reach into a cell
+    std::vector<std::vector<int>> cells;
+    // rasterized outlines of a cell, empty until the cell was drawn
+    std::vector<cv::Mat> masks;
+};
+
+#endif // DEFECT_LAYER_H
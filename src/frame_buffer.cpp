@@ -0,0 +1,22 @@
+#include "frame_buffer.h"
+
+#include <cstdint>
+
+cv::Mat&
+FrameBuffer::resize(const cv::Size& size, int type) {
+    if (frame.size() == size && frame.type() == type) {
+        return frame;
+    }
+
+    const size_t elemSize = CV_ELEM_SIZE(type);
+    const size_t step = (size.width * elemSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    const size_t bytes = step * size.height + ALIGNMENT;
+    if (storage.total() < bytes) {
+        storage.create(1, static_cast<int>(bytes), CV_8UC1);
+    }
+
+    const uintptr_t address = reinterpret_cast<uintptr_t>(storage.data);
+    uchar* data = storage.data + (ALIGNMENT - address % ALIGNMENT) % ALIGNMENT;
+    frame = cv::Mat(size, type, data, step);
+    return frame;
+}
@@ -0,0 +1,37 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+
+/**
+ * Reusable matrix for buffers rendered every frame.
+ *
+ * The storage only grows: resizing to a size which fits into the current storage,
+ * e.g. after the window became smaller or the viewport moved, reuses it without
+ * allocating. Rows start at multiples of ALIGNMENT bytes so that SIMD kernels can
+ * process them with aligned loads.
+ */
+class FrameBuffer {
+public:
+    // alignment of the rows in bytes
+    static const size_t ALIGNMENT = 64;
+
+    /**
+     * Retrieve the buffer with the given size and type. The content is undefined if
+     * the size or the type changed.
+     */
+    cv::Mat& resize(const cv::Size& size, int type);
+
+    cv::Mat& mat() { return frame; }
+    const cv::Mat& mat() const { return frame; }
+
+private:
+    // bytes of the buffer including the padding needed for the alignment
+    cv::Mat storage;
+    // header of the buffer pointing into the storage
+    cv::Mat frame;
+};
+
+#endif // FRAME_BUFFER_H
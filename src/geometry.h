@@ -0,0 +1,21 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Union of two rectangles where an empty rectangle acts as neutral element,
+ * used to accumulate the modified regions of the GT and the view.
+ */
+inline cv::Rect
+unite(const cv::Rect& a, const cv::Rect& b) {
+    if (a.empty()) {
+        return b;
+    }
+    if (b.empty()) {
+        return a;
+    }
+    return a | b;
+}
+
+#endif // GEOMETRY_H
@@ -0,0 +1,254 @@
+#include "gt_writer.h"
+
+#include <boost/filesystem.hpp>
+
+#include "tiled_image.h"
+
+#include <cstdio>
+#include <iostream>
+#include <set>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// time without new tasks after which an incomplete batch of the journal is written
+const std::chrono::seconds JOURNAL_DELAY(2);
+
+}
+
+GtWriter::GtWriter(ProgressStore& progress, size_t journalBatch)
+    : progress(progress), journalBatch(journalBatch), flushRequested(false), stop(false) {
+    worker = std::thread(&GtWriter::work, this);
+}
+
+GtWriter::~GtWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void
+GtWriter::save(const std::string& file, const TiledGT& imageGT) {
+    // copy so that the GT can be edited further while it is written
+    std::shared_ptr<const TiledGT> copy = imageGT.clone();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        PendingGT& pendingGT = pendingGTs[file];
+        pendingGT.imageGT = copy;
+        if (!pendingGT.queued) {
+            pendingGT.queued = true;
+            tasks.push_back(Task{ file, "" });
+        }
+    }
+    wake.notify_all();
+}
+
+void
+GtWriter::journal(const std::string& imageName, const std::string& file) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(Task{ file, imageName });
+    }
+    wake.notify_all();
+}
+
+bool
+GtWriter::pending(const std::string& file, std::shared_ptr<const TiledGT>& imageGT) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pendingGT = pendingGTs.find(file);
+    if (pendingGT == pendingGTs.end()) {
+        return false;
+    }
+    imageGT = pendingGT->second.imageGT;
+    return true;
+}
+
+/**
+ * Main loop of the writer thread.
+ */
+void
+GtWriter::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        if (!tasks.empty()) {
+            Task task = tasks.front();
+            tasks.pop_front();
+
+            if (!task.imageName.empty()) {
+                // tasks are handled in order, so the GT was written before if it was saved
+                if (failedGTs.count(task.file)) {
+                    std::cout << "Error! Not recording image[" << task.imageName
+                              << "] as annotated since its GT was not saved!" << std::endl;
+                    continue;
+                }
+                journalEntries.push_back(task.imageName);
+                if (journalEntries.size() >= journalBatch) {
+                    writeJournal(lock);
+                }
+                continue;
+            }
+
+            PendingGT& pendingGT = pendingGTs[task.file];
+            pendingGT.queued = false;
+            std::shared_ptr<const TiledGT> imageGT = pendingGT.imageGT;
+
+            lock.unlock();
+            const bool written = write(task.file, *imageGT);
+            if (!written) {
+                std::cout << "Error! Could not save GT[" << task.file << "]!" << std::endl;
+            } else {
+                // the statistics walk all tiles, so they are computed here instead of by the GUI thread
+                std::cout << "Saved GT: " << task.file << " (" << imageGT->labeledPixels() << " labeled pixels in "
+                          << imageGT->allocatedTiles() << "/" << imageGT->columns() * imageGT->rows() << " tiles, "
+                          << imageGT->bytes() / 1024 << " KiB)" << std::endl;
+            }
+            lock.lock();
+
+            if (written) {
+                failedGTs.erase(task.file);
+            } else {
+                failedGTs.insert(task.file);
+            }
+
+            // keep the GT as pending if it was saved again in the meantime
+            auto finished = pendingGTs.find(task.file);
+            if (finished != pendingGTs.end() && !finished->second.queued && finished->second.imageGT == imageGT) {
+                pendingGTs.erase(finished);
+            }
+            continue;
+        }
+
+        // all GTs are written so the journal may be completed
+        if (!journalEntries.empty() && (flushRequested || stop)) {
+            writeJournal(lock);
+            continue;
+        }
+        if (stop) {
+            return;
+        }
+
+        flushRequested = false;
+
+        auto woken = [this]() { return stop || flushRequested || !tasks.empty(); };
+        if (journalEntries.empty()) {
+            wake.wait(lock, woken);
+        } else if (!wake.wait_for(lock, JOURNAL_DELAY, woken)) {
+            // write an incomplete batch if nothing happened for a while
+            flushRequested = true;
+        }
+    }
+}
+
+/**
+ * Append the collected journal entries to the journal.
+ * Requires the lock which is released while writing.
+ */
+void
+GtWriter::writeJournal(std::unique_lock<std::mutex>& lock) {
+    std::vector<std::string> entries;
+    entries.swap(journalEntries);
+
+    lock.unlock();
+    if (!progress.append(entries)) {
+        std::cout << "Error! Could not write to the journal of annotated images!" << std::endl;
+    }
+    lock.lock();
+}
+
+/**
+ * Encode a GT according to the extension of the file or write it as tiled GT directory.
+ */
+bool
+GtWriter::write(const std::string& file, const TiledGT& imageGT) {
+    if (is_tiled(file)) {
+        return writeTiles(file, imageGT);
+    }
+
+    std::vector<uchar> buffer;
+    if (!cv::imencode(fs::path(file).extension().string(), imageGT.toMat(), buffer)) {
+        return false;
+    }
+    return writeAtomically(file, buffer);
+}
+
+/**
+ * Write the allocated tiles of a GT into a tiled GT directory and remove the tiles
+ * which are no longer allocated. Every file is replaced atomically, the description
+ * is written last.
+ */
+bool
+GtWriter::writeTiles(const std::string& directory, const TiledGT& imageGT) {
+    boost::system::error_code error;
+    fs::create_directories(directory, error);
+    if (error) {
+        return false;
+    }
+
+    std::set<std::string> allocated;
+    cv::Mat labels;
+    for (int row = 0; row < imageGT.rows(); row++) {
+        for (int column = 0; column < imageGT.columns(); column++) {
+            if (!imageGT.tile(column, row, labels)) {
+                continue;
+            }
+            std::vector<uchar> buffer;
+            const std::string name = TiledGT::tileName(column, row);
+            if (!cv::imencode(".png", labels, buffer)
+                    || !writeAtomically((fs::path(directory) / name).string(), buffer)) {
+                return false;
+            }
+            allocated.insert(name);
+        }
+    }
+
+    fs::directory_iterator end_itr;
+    for (fs::directory_iterator itr(directory, error); !error && itr != end_itr; itr.increment(error)) {
+        const std::string name = itr->path().filename().string();
+        if (itr->path().extension() == ".png" && !allocated.count(name)) {
+            fs::remove(itr->path(), error);
+        }
+    }
+
+    const std::string text = imageGT.description();
+    return writeAtomically((fs::path(directory) / "tiles.txt").string(), std::vector<uchar>(text.begin(), text.end()));
+}
+
+/**
+ * Write a file atomically by renaming a completely written temporary file.
+ */
+bool
+GtWriter::writeAtomically(const std::string& file, const std::vector<uchar>& buffer) {
+    const fs::path path(file);
+
+    // the temporary file has to be in the same directory for the rename to be atomic
+    const fs::path directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+    const std::string temporary = (directory / ("." + path.filename().string() + ".tmp")).string();
+
+    FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool written = std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+    written = std::fflush(out) == 0 && written;
+    written = fsync(fileno(out)) == 0 && written;
+    written = std::fclose(out) == 0 && written;
+    if (!written || std::rename(temporary.c_str(), file.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    // make the rename itself durable
+    int dir = open(directory.string().c_str(), O_RDONLY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef GT_WRITER_H
+#define GT_WRITER_H
+
+#include <opencv2/opencv.hpp>
+
+#include "progress_store.h"
+#include "tiled_gt.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Background writer for GTs and the journal of annotated images.
+ *
+ * Saving a GT only copies it and hands it to the writer thread which encodes it,
+ * writes it to a temporary file and atomically renames that file to the GT so that
+ * a crash never leaves a truncated GT behind. Saving the same GT again before it
+ * was written replaces the pending copy. GTs of tiled images are written as tiled GT
+ * directories (see TiledGT) where only the allocated tiles are stored.
+ *
+ * Journal entries are written in batches after all GTs saved before them were
+ * written, so that an image is never recorded as annotated before its GT exists.
+ * The entry of an image whose GT could not be written is dropped.
+ */
+class GtWriter {
+public:
+    GtWriter(ProgressStore& progress, size_t journalBatch = 32);
+    // writes everything which is still pending
+    ~GtWriter();
+
+    /**
+     * Save a copy of a GT to the given file in the background.
+     */
+    void save(const std::string& file, const TiledGT& imageGT);
+
+    /**
+     * Record an image as annotated in the journal unless its GT file could not be written.
+     */
+    void journal(const std::string& imageName, const std::string& file);
+
+    /**
+     * Retrieve the GT which is still waiting to be written to a file.
+     * Returns false if there is none.
+     */
+    bool pending(const std::string& file, std::shared_ptr<const TiledGT>& imageGT) const;
+
+private:
+    struct Task {
+        // file of a GT to write or of the GT a journal entry requires
+        std::string file;
+        // name of an image to journal, empty to write the GT
+        std::string imageName;
+    };
+    struct PendingGT {
+        std::shared_ptr<const TiledGT> imageGT;
+        // if a task to write the GT is queued
+        bool queued;
+    };
+
+    void work();
+    void writeJournal(std::unique_lock<std::mutex>& lock);
+    static bool write(const std::string& file, const TiledGT& imageGT);
+    static bool writeTiles(const std::string& directory, const TiledGT& imageGT);
+    static bool writeAtomically(const std::string& file, const std::vector<uchar>& buffer);
+
+    ProgressStore& progress;
+    size_t journalBatch;
+
+    mutable std::mutex mutex;
+    // wakes up the writer thread
+    std::condition_variable wake;
+
+    std::deque<Task> tasks;
+    std::unordered_map<std::string, PendingGT> pendingGTs;
+    // files whose GT could not be written the last time
+    std::unordered_set<std::string> failedGTs;
+    // journal entries collected for the next batch
+    std::vector<std::string> journalEntries;
+    // if the journal should be written even if the batch is not full
+    bool flushRequested;
+    bool stop;
+
+    std::thread worker;
+};
+
+#endif // GT_WRITER_H
@@ -0,0 +1,122 @@
+#include "image_cache.h"
+
+#include <boost/filesystem.hpp>
+
+#include <iostream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+size_t
+bytes_of(const CachedImage& data) {
+    return (data.image ? data.image->bytes() : 0) + (data.imageGT ? data.imageGT->bytes() : 0);
+}
+
+}
+
+ImageCache::ImageCache(size_t budgetBytes, int threads, const GtWriter* writer, bool packedGT)
+    : writer(writer), packedGT(packedGT), budget(budgetBytes),
+      images(budgetBytes, bytes_of, [this](const std::string& key) { return wanted.count(key) > 0; }),
+      stop(false) {
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(&ImageCache::work, this));
+    }
+}
+
+ImageCache::~ImageCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        requests.clear();
+    }
+    requested.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void
+ImageCache::prefetch(const std::vector<Files>& files) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // requests of the previous window which were not started are obsolete
+        requests.clear();
+        wanted.clear();
+        for (const Files& f : files) {
+            wanted.insert(f.first);
+            if (!images.contains(f.first)) {
+                requests.push_back(f);
+            }
+        }
+    }
+    requested.notify_all();
+}
+
+CachedImage
+ImageCache::get(const Files& files) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // the previously displayed image and its GT grew while they were annotated
+    images.remeasure();
+    // decodes the image directly if it was not prefetched
+    return images.get(lock, files.first, [&]() { return load(files); });
+}
+
+/**
+ * Decode an image and its GT or create an empty GT if none is available.
+ */
+CachedImage
+ImageCache::load(const Files& files) const {
+    CachedImage data;
+    // the decoded tiles of a tiled image are counted by the cache as well
+    data.image = TiledImage::open(files.first, budget);
+    data.gtLoaded = false;
+    if (!data.image) {
+        return data;
+    }
+
+    // a GT which is not yet written is more recent than its file
+    std::shared_ptr<const TiledGT> pendingGT;
+    if (writer && writer->pending(files.second, pendingGT)) {
+        data.imageGT = pendingGT->clone();
+        data.gtLoaded = true;
+        return data;
+    }
+
+    if (fs::exists(files.second)) {
+        data.imageGT = TiledGT::open(files.second, packedGT);
+        if (data.imageGT && data.imageGT->size() != data.image->size()) {
+            data.imageGT = nullptr;
+        }
+        data.gtLoaded = data.imageGT != nullptr;
+        if (!data.imageGT) {
+            std::cout << "Error! Could not load GT[" << files.second << "]!" << std::endl;
+        }
+    }
+    if (!data.imageGT) {
+        data.imageGT = std::make_shared<TiledGT>(data.image->size(), TiledGT::DEFAULT_TILE_SIZE, packedGT);
+    }
+    return data;
+}
+
+/**
+ * Main loop of the worker threads decoding requested images.
+ */
+void
+ImageCache::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        requested.wait(lock, [this]() { return stop || !requests.empty(); });
+        if (stop) {
+            return;
+        }
+
+        Files files = requests.front();
+        requests.pop_front();
+        // skip images which are already cached or decoded by another thread
+        if (images.contains(files.first)) {
+            continue;
+        }
+        images.get(lock, files.first, [&]() { return load(files); }, true);
+    }
+}
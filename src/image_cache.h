@@ -0,0 +1,94 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <opencv2/opencv.hpp>
+
+#include "gt_writer.h"
+#include "lru_loader.h"
+#include "tiled_gt.h"
+#include "tiled_image.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * Image together with its GT as loaded from disk.
+ */
+struct CachedImage {
+    // nullptr if the image could not be opened
+    std::shared_ptr<TiledImage> image;
+    // black if there was none on disk
+    std::shared_ptr<TiledGT> imageGT;
+    // if the GT was loaded from disk
+    bool gtLoaded;
+};
+
+/**
+ * LRU cache of images and their GTs which are decoded by worker threads ahead of time.
+ *
+ * The annotation loop requests the images it will probably display next through
+ * prefetch and retrieves them through get, which only decodes an image itself if it
+ * was not prefetched. Entries share their GT with the retrieved images so that
+ * edits of a GT are visible when it is retrieved again. Tiled images only count
+ * their decoded tiles, which may use the whole budget. The memory used by entries
+ * is limited by a budget; entries outside the current prefetch window are evicted
+ * first and prefetched entries exceeding the budget are dropped. Since images and
+ * GTs grow while they are displayed, entries are measured again on every get.
+ *
+ * GTs which are still waiting to be written by the GtWriter are taken from it
+ * instead of the outdated files.
+ */
+class ImageCache {
+public:
+    // pair of image path and GT path
+    typedef std::pair<std::string, std::string> Files;
+
+    /**
+     * GTs are packed into bits (see TiledGT) if packedGT is set.
+     */
+    ImageCache(size_t budgetBytes, int threads, const GtWriter* writer = nullptr, bool packedGT = false);
+    ~ImageCache();
+
+    /**
+     * Replace the pending prefetch requests. The files are ordered by priority
+     * and should include the currently displayed image.
+     */
+    void prefetch(const std::vector<Files>& files);
+
+    /**
+     * Retrieve an image and its GT. Waits if it is currently decoded by a worker and
+     * decodes it directly if it was not prefetched. The image is nullptr on failure.
+     */
+    CachedImage get(const Files& files);
+
+private:
+    CachedImage load(const Files& files) const;
+
+    void work();
+
+    const GtWriter* writer;
+    bool packedGT;
+    size_t budget;
+
+    std::mutex mutex;
+    // wakes up workers if new requests are available
+    std::condition_variable requested;
+
+    // keys of the current prefetch window which are not evicted if possible
+    std::unordered_set<std::string> wanted;
+    // images keyed by their path
+    LruLoader<std::string, CachedImage> images;
+    std::deque<Files> requests;
+
+    bool stop;
+    std::vector<std::thread> workers;
+};
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,51 @@
+#include "image_names.h"
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+NameRule::NameRule(const std::string& pattern)
+    : useRegex(!pattern.empty()) {
+    if (useRegex) {
+        regex = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+    }
+}
+
+std::string
+NameRule::operator()(const std::string& path) const {
+    if (!useRegex) {
+        if (path.size() < 10) {
+            return fs::path(path).stem().string();
+        }
+        return path.substr(path.size() - 10, 6);
+    }
+
+    std::smatch match;
+    if (!std::regex_search(path, match, regex)) {
+        return fs::path(path).stem().string();
+    }
+    return match.size() > 1 ? match[1].str() : match[0].str();
+}
+
+const uint32_t ImageNames::NONE;
+
+uint32_t
+ImageNames::intern(const std::string& name) {
+    auto inserted = ids.insert(std::make_pair(name, static_cast<uint32_t>(names.size())));
+    if (inserted.second) {
+        names.push_back(name);
+    }
+    return inserted.first->second;
+}
+
+uint32_t
+ImageNames::find(const std::string& name) const {
+    auto id = ids.find(name);
+    return id == ids.end() ? NONE : id->second;
+}
+
+void
+ImageNames::clear() {
+    ids.clear();
+    names.clear();
+}
@@ -0,0 +1,62 @@
+#ifndef IMAGE_NAMES_H
+#define IMAGE_NAMES_H
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Rule deriving the name of an image, as used by the journal and the label file, from its path.
+ *
+ * By default the name consists of the six characters in front of a four character
+ * extension (e.g. ".png"). Otherwise it is given by a regular expression which is
+ * compiled once and searched in the path: the name is the first capture group or the
+ * whole match if there is no group. Paths without a match are named by their stem.
+ */
+class NameRule {
+public:
+    /**
+     * Create a rule from a regular expression or the default rule if it is empty.
+     * Throws std::regex_error if the expression is invalid.
+     */
+    explicit NameRule(const std::string& pattern = "");
+
+    std::string operator()(const std::string& path) const;
+
+private:
+    bool useRegex;
+    std::regex regex;
+};
+
+/**
+ * Interned image names: every distinct name is mapped to a dense integer ID
+ * so that per-image data can be stored in flat vectors indexed by the ID.
+ */
+class ImageNames {
+public:
+    // ID of names which are not interned
+    static const uint32_t NONE = UINT32_MAX;
+
+    /**
+     * Retrieve the ID of a name and assign the next ID if it is new.
+     */
+    uint32_t intern(const std::string& name);
+
+    /**
+     * Retrieve the ID of a name or NONE if it is not interned.
+     */
+    uint32_t find(const std::string& name) const;
+
+    void clear();
+
+    size_t size() const { return names.size(); }
+    const std::string& operator[](uint32_t id) const { return names[id]; }
+
+private:
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> names;
+};
+
+#endif // IMAGE_NAMES_H
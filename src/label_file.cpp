@@ -0,0 +1,440 @@
+#include "label_file.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// first bytes of a cache file followed by the version of the format
+const char CACHE_MAGIC[8] = {'P', 'W', 'A', 'L', 'A', 'B', 'E', 'L'};
+const uint32_t CACHE_VERSION = 1;
+// smaller chunks are not worth a thread
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+/**
+ * Read only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+    MappedFile() : data(nullptr), size(0) {}
+    ~MappedFile() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Map a file with the given status. Empty files are mapped as empty range.
+     */
+    bool map(int fd, const struct stat& info) {
+        size = info.st_size;
+        if (size == 0) {
+            return true;
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            size = 0;
+            return false;
+        }
+        // the file is read from front to back
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+        return true;
+    }
+
+    const char* data;
+    size_t size;
+};
+
+/**
+ * Identity of the label file a cache belongs to.
+ */
+struct CacheKey {
+    int64_t size;
+    int64_t seconds;
+    int64_t nanoseconds;
+};
+
+CacheKey
+key_of(const struct stat& info) {
+    CacheKey key;
+    key.size = info.st_size;
+    key.seconds = info.st_mtim.tv_sec;
+    key.nanoseconds = info.st_mtim.tv_nsec;
+    return key;
+}
+
+/**
+ * Regions of an image in a part of the label file.
+ */
+struct ChunkImage {
+    ChunkImage() : anchor(std::numeric_limits<int>::max(), std::numeric_limits<int>::max()) {}
+
+    cv::Point anchor;
+    std::vector<cv::Rect> defects;
+};
+
+/**
+ * Result of parsing a part of the label file.
+ */
+struct Chunk {
+    std::unordered_map<std::string, ChunkImage> images;
+    // false if parsing stopped at a malformed record
+    bool complete;
+};
+
+inline bool
+is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * Find the next whitespace separated token. Returns false at the end of the range.
+ */
+inline bool
+next_token(const char*& position, const char* end, const char*& begin, const char*& tokenEnd) {
+    while (position < end && is_space(*position)) {
+        position++;
+    }
+    if (position == end) {
+        return false;
+    }
+    begin = position;
+    while (position < end && !is_space(*position)) {
+        position++;
+    }
+    tokenEnd = position;
+    return true;
+}
+
+inline bool
+parse_int(const char* begin, const char* end, int& value) {
+    bool negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+')) {
+        negative = *begin == '-';
+        begin++;
+    }
+    if (begin == end) {
+        return false;
+    }
+    long long result = 0;
+    for (; begin < end; begin++) {
+        if (*begin < '0' || *begin > '9') {
+            return false;
+        }
+        result = result * 10 + (*begin - '0');
+        if (result > static_cast<long long>(std::numeric_limits<int>::max()) + 1) {
+            return false;
+        }
+    }
+    result = negative ? -result : result;
+    if (result > std::numeric_limits<int>::max()) {
+        return false;
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+/**
+ * Parse the records of a part of the label file.
+ */
+void
+parse_chunk(const char* position, const char* end, Chunk& chunk, const std::atomic<bool>* cancel) {
+    chunk.complete = true;
+    const char* begin;
+    const char* tokenEnd;
+    while (next_token(position, end, begin, tokenEnd)) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) {
+            chunk.complete = false;
+            return;
+        }
+        std::string filename(begin, tokenEnd);
+
+        // the coordinates are stored as yMin xMin yMax xMax
+        int values[4];
+        for (int& value : values) {
+            if (!next_token(position, end, begin, tokenEnd) || !parse_int(begin, tokenEnd, value)) {
+                chunk.complete = false;
+                return;
+            }
+        }
+        if (!next_token(position, end, begin, tokenEnd)) {
+            chunk.complete = false;
+            return;
+        }
+        const int yMin = values[0], xMin = values[1], yMax = values[2], xMax = values[3];
+
+        ChunkImage& image = chunk.images[filename];
+        image.anchor.x = std::min(image.anchor.x, xMin);
+        image.anchor.y = std::min(image.anchor.y, yMin);
+
+        if (tokenEnd - begin == 5 && std::memcmp(begin, "sound", 5) == 0) {
+            continue;
+        }
+        image.defects.push_back(cv::Rect(xMin, yMin, xMax - xMin, yMax - yMin));
+    }
+}
+
+/**
+ * Parse the mapped label file in chunks split at line boundaries.
+ */
+void
+parse_labels(const MappedFile& mapped, LabelMap& labels, unsigned threads, const std::atomic<bool>* cancel) {
+    const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, mapped.size / MIN_CHUNK_SIZE));
+
+    std::vector<const char*> bounds(1, mapped.data);
+    const char* end = mapped.data + mapped.size;
+    for (size_t i = 1; i < chunkCount; i++) {
+        const char* split = std::max(bounds.back(), mapped.data + mapped.size / chunkCount * i);
+        split = static_cast<const char*>(std::memchr(split, '\n', end - split));
+        bounds.push_back(split ? split + 1 : end);
+    }
+    bounds.push_back(end);
+
+    std::vector<Chunk> chunks(chunkCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunkCount; i++) {
+        workers.push_back(std::thread(parse_chunk, bounds[i], bounds[i + 1], std::ref(chunks[i]), cancel));
+    }
+    parse_chunk(bounds[0], bounds[1], chunks[0], cancel);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    // the images as expected here are extracted part of the original images,
+    // thus, the rectangles have to be moved to fit the extracted part
+    std::unordered_map<std::string, cv::Point> anchors;
+    for (Chunk& chunk : chunks) {
+        for (auto& entry : chunk.images) {
+            auto anchor = anchors.insert(std::make_pair(entry.first, entry.second.anchor));
+            if (!anchor.second) {
+                anchor.first->second.x = std::min(anchor.first->second.x, entry.second.anchor.x);
+                anchor.first->second.y = std::min(anchor.first->second.y, entry.second.anchor.y);
+            }
+            if (!entry.second.defects.empty()) {
+                std::vector<cv::Rect>& defects = labels[entry.first];
+                defects.insert(defects.end(), entry.second.defects.begin(), entry.second.defects.end());
+            }
+        }
+        // records after a malformed record are ignored
+        if (!chunk.complete) {
+            break;
+        }
+    }
+    for (auto& entry : labels) {
+        for (cv::Rect& rect : entry.second) {
+            rect -= anchors[entry.first];
+        }
+    }
+}
+
+/**
+ * Read a fixed size value from the cache and advance the position.
+ */
+template <typename T>
+bool
+read_value(const char*& position, const char* end, T& value) {
+    if (static_cast<size_t>(end - position) < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, position, sizeof(T));
+    position += sizeof(T);
+    return true;
+}
+
+/**
+ * Read the cache of a label file. Returns false if it does not exist, is damaged
+ * or belongs to another version of the label file.
+ */
+bool
+read_cache(const std::string& cacheFile, const CacheKey& key, LabelMap& labels) {
+    int fd = open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    MappedFile mapped;
+    bool ok = fstat(fd, &info) == 0 && mapped.map(fd, info);
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+
+    const char* position = mapped.data;
+    const char* end = mapped.data + mapped.size;
+    char magic[sizeof(CACHE_MAGIC)];
+    uint32_t version;
+    CacheKey cached;
+    uint64_t imageCount;
+    if (!read_value(position, end, magic) || std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0
+            || !read_value(position, end, version) || version != CACHE_VERSION
+            || !read_value(position, end, cached.size) || !read_value(position, end, cached.seconds)
+            || !read_value(position, end, cached.nanoseconds) || !read_value(position, end, imageCount)
+            || cached.size != key.size || cached.seconds != key.seconds || cached.nanoseconds != key.nanoseconds) {
+        return false;
+    }
+
+    labels.clear();
+    labels.reserve(imageCount);
+    for (uint64_t i = 0; i < imageCount; i++) {
+        uint32_t nameLength, defectCount;
+        if (!read_value(position, end, nameLength) || static_cast<size_t>(end - position) < nameLength) {
+            labels.clear();
+            return false;
+        }
+        std::vector<cv::Rect>& defects = labels[std::string(position, nameLength)];
+        position += nameLength;
+
+        if (!read_value(position, end, defectCount) || static_cast<size_t>(end - position) / (4 * sizeof(int32_t)) < defectCount) {
+            labels.clear();
+            return false;
+        }
+        defects.resize(defectCount);
+        for (cv::Rect& rect : defects) {
+            int32_t values[4];
+            read_value(position, end, values);
+            rect = cv::Rect(values[0], values[1], values[2], values[3]);
+        }
+    }
+    return position == end;
+}
+
+/**
+ * Atomically write the cache of a label file.
+ */
+bool
+write_cache(const std::string& cacheFile, const CacheKey& key, const LabelMap& labels) {
+    const std::string temporary = cacheFile + ".tmp";
+    FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+
+    const uint64_t imageCount = labels.size();
+    bool written = std::fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, out) == 1
+        && std::fwrite(&CACHE_VERSION, sizeof(CACHE_VERSION), 1, out) == 1
+        && std::fwrite(&key.size, sizeof(key.size), 1, out) == 1
+        && std::fwrite(&key.seconds, sizeof(key.seconds), 1, out) == 1
+        && std::fwrite(&key.nanoseconds, sizeof(key.nanoseconds), 1, out) == 1
+        && std::fwrite(&imageCount, sizeof(imageCount), 1, out) == 1;
+
+    std::vector<int32_t> values;
+    for (auto it = labels.begin(); written && it != labels.end(); ++it) {
+        const uint32_t nameLength = it->first.size();
+        const uint32_t defectCount = it->second.size();
+        values.clear();
+        for (const cv::Rect& rect : it->second) {
+            values.insert(values.end(), {rect.x, rect.y, rect.width, rect.height});
+        }
+        written = std::fwrite(&nameLength, sizeof(nameLength), 1, out) == 1
+            && std::fwrite(it->first.data(), 1, nameLength, out) == nameLength
+            && std::fwrite(&defectCount, sizeof(defectCount), 1, out) == 1
+            && std::fwrite(values.data(), sizeof(int32_t), values.size(), out) == values.size();
+    }
+    written = std::fclose(out) == 0 && written;
+
+    if (!written || std::rename(temporary.c_str(), cacheFile.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
+
+bool
+load_labels(const std::string& file, LabelMap& labels, unsigned threads, const std::atomic<bool>* cancel) {
+    labels.clear();
+
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+
+    const fs::path path(file);
+    const std::string cacheFile = (path.parent_path() / ("." + path.filename().string() + ".cache")).string();
+    const CacheKey key = key_of(info);
+    if (read_cache(cacheFile, key, labels)) {
+        close(fd);
+        return true;
+    }
+
+    MappedFile mapped;
+    const bool ok = mapped.map(fd, info);
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+    parse_labels(mapped, labels, std::max(threads, 1u), cancel);
+    if (cancel && *cancel) {
+        labels.clear();
+        return false;
+    }
+
+    if (!write_cache(cacheFile, key, labels)) {
+        std::cout << "Warning! Could not write label cache[" << cacheFile << "]!" << std::endl;
+    }
+    return true;
+}
+
+LabelLoader::LabelLoader(const std::string& file, unsigned threads, const ImageNames& names)
+    : loaded(false), cancel(false) {
+    worker = std::thread(&LabelLoader::load, this, file, threads, std::cref(names));
+}
+
+LabelLoader::~LabelLoader() {
+    cancel = true;
+    worker.join();
+}
+
+const std::vector<cv::Rect>*
+LabelLoader::find(uint32_t nameId) const {
+    if (!loaded || nameId >= defects.size() || defects[nameId].empty()) {
+        return nullptr;
+    }
+    return &defects[nameId];
+}
+
+/**
+ * Main method of the worker thread loading the label file.
+ */
+void
+LabelLoader::load(const std::string& file, unsigned threads, const ImageNames& names) {
+    LabelMap labels;
+    if (!load_labels(file, labels, threads, &cancel) && !cancel) {
+        std::cout << "Error! Could not read label file[" << file << "]!" << std::endl;
+    }
+
+    defects.resize(names.size());
+    for (auto& entry : labels) {
+        const uint32_t id = names.find(entry.first);
+        if (id != ImageNames::NONE) {
+            defects[id].swap(entry.second);
+        }
+    }
+    // publishes the defects to the reading threads
+    loaded = true;
+}
@@ -0,0 +1,75 @@
+#ifndef LABEL_FILE_H
+#define LABEL_FILE_H
+
+#include <opencv2/opencv.hpp>
+
+#include "image_names.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// defects of every image by the name of the image
+typedef std::unordered_map<std::string, std::vector<cv::Rect>> LabelMap;
+
+/**
+ * Load the defects from a label file (manlabel.txt).
+ *
+ * Every record of the label file consists of the name of an image, the bounds of a
+ * region as yMin xMin yMax xMax and its defect type. Regions of the type "sound" are
+ * no defects but together with the defects define the anchor of an image: the images
+ * are extracted parts of the original images, thus, all defects are moved by the
+ * minimal coordinates of the regions of their image.
+ *
+ * The file is memory mapped and split into chunks at line boundaries which are parsed
+ * in parallel. Like before reading stops at the first malformed record. The result is
+ * stored in a binary cache next to the label file (.<name>.cache) which is keyed on the
+ * modification time and size of the label file, so that later launches skip parsing.
+ * A missing label file results in no defects.
+ *
+ * Loading stops early and returns false if cancel is set.
+ */
+bool
+load_labels(const std::string& file, LabelMap& labels, unsigned threads, const std::atomic<bool>* cancel = nullptr);
+
+/**
+ * Loads the defects of a label file in the background, so that the first image can be
+ * displayed independent of the size of the label file. Until loading finished no
+ * defects are available. Afterwards the defects are never modified again and can be
+ * read without locking.
+ *
+ * The defects are stored by the IDs of the interned image names. Defects of images
+ * which are not interned are dropped. The names must not change while loading.
+ */
+class LabelLoader {
+public:
+    LabelLoader(const std::string& file, unsigned threads, const ImageNames& names);
+    ~LabelLoader();
+
+    LabelLoader(const LabelLoader&) = delete;
+    LabelLoader& operator=(const LabelLoader&) = delete;
+
+    /**
+     * Check if loading finished, successfully or not.
+     */
+    bool ready() const { return loaded; }
+
+    /**
+     * Find the defects of an image. Returns nullptr if there are none or
+     * they are not loaded yet.
+     */
+    const std::vector<cv::Rect>* find(uint32_t nameId) const;
+
+private:
+    void load(const std::string& file, unsigned threads, const ImageNames& names);
+
+    // defects by the ID of the image name
+    std::vector<std::vector<cv::Rect>> defects;
+    std::atomic<bool> loaded;
+    std::atomic<bool> cancel;
+    std::thread worker;
+};
+
+#endif // LABEL_FILE_H
@@ -0,0 +1,152 @@
+#ifndef LRU_LOADER_H
+#define LRU_LOADER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * LRU cache of values which are loaded on demand by several threads within a memory budget.
+ *
+ * A value is loaded by the first thread requesting it while a placeholder keeps other
+ * threads from loading it again; they wait until it is available instead. Once the
+ * budget is exceeded the least recently used values are evicted, except for the most
+ * recently used one and the ones the owner wants to keep.
+ *
+ * The loader is protected by the mutex of its owner, which has to be locked for every
+ * call. It is released while a value is loaded.
+ */
+template <typename Key, typename Value>
+class LruLoader {
+public:
+    // memory used by a value
+    typedef std::function<size_t(const Value&)> Measure;
+    // if a value should not be evicted
+    typedef std::function<bool(const Key&)> Keep;
+
+    LruLoader(size_t budgetBytes, Measure measure, Keep keep = nullptr)
+        : budget(budgetBytes), used(0), measure(measure), keep(keep) {
+    }
+
+    /**
+     * Check if a value is loaded or currently loading.
+     */
+    bool contains(const Key& key) const {
+        return entries.find(key) != entries.end();
+    }
+
+    /**
+     * Retrieve a value, waiting for the thread currently loading it or loading it
+     * with load if it is missing. A prefetched value which does not fit into the
+     * budget is dropped again after it was returned.
+     */
+    template <typename Load>
+    Value get(std::unique_lock<std::mutex>& lock, const Key& key, Load load, bool prefetched = false) {
+        auto entry = entries.find(key);
+        if (entry != entries.end()) {
+            loaded.wait(lock, [&]() {
+                entry = entries.find(key);
+                return entry == entries.end() || !entry->second.loading;
+            });
+        }
+        if (entry != entries.end()) {
+            // mark as most recently used
+            lru.splice(lru.begin(), lru, entry->second.lruPosition);
+            return entry->second.value;
+        }
+
+        entries[key].loading = true;
+        lock.unlock();
+        Value value = load();
+        lock.lock();
+
+        insert(key, value, prefetched);
+        loaded.notify_all();
+        return value;
+    }
+
+    /**
+     * Measure the loaded values again for values which grow after they were loaded
+     * and evict values if the budget is exceeded.
+     */
+    void remeasure() {
+        used = 0;
+        for (const Key& key : lru) {
+            Entry& entry = entries.find(key)->second;
+            entry.bytes = measure(entry.value);
+            used += entry.bytes;
+        }
+        evict();
+    }
+
+    /**
+     * Memory used by the loaded values.
+     */
+    size_t bytes() const {
+        return used;
+    }
+
+private:
+    struct Entry {
+        Value value;
+        size_t bytes;
+        bool loading;
+        typename std::list<Key>::iterator lruPosition;
+    };
+
+    /**
+     * Insert a loaded value in place of its placeholder and evict values
+     * if the budget is exceeded.
+     */
+    void insert(const Key& key, const Value& value, bool prefetched) {
+        Entry& entry = entries[key];
+        entry.value = value;
+        entry.bytes = measure(value);
+        entry.loading = false;
+        lru.push_front(key);
+        entry.lruPosition = lru.begin();
+        used += entry.bytes;
+
+        evict();
+
+        if (prefetched && used > budget && lru.size() > 1) {
+            used -= entry.bytes;
+            lru.erase(entry.lruPosition);
+            entries.erase(key);
+        }
+    }
+
+    /**
+     * Evict the least recently used values which are not kept until the budget is met.
+     */
+    void evict() {
+        auto it = lru.end();
+        while (used > budget && it != lru.begin()) {
+            --it;
+            if (it == lru.begin() || (keep && keep(*it))) {
+                continue;
+            }
+            auto entry = entries.find(*it);
+            used -= entry->second.bytes;
+            entries.erase(entry);
+            it = lru.erase(it);
+        }
+    }
+
+    size_t budget;
+    size_t used;
+    Measure measure;
+    Keep keep;
+
+    // signals that a value finished loading
+    std::condition_variable loaded;
+
+    std::unordered_map<Key, Entry> entries;
+    // keys of loaded values, most recently used first
+    std::list<Key> lru;
+};
+
+#endif // LRU_LOADER_H
@@ -0,0 +1,225 @@
+#include "progress_store.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// number of redundant lines which are always tolerated before compacting
+const size_t COMPACTION_SLACK = 1024;
+
+/**
+ * Write a complete buffer to a file descriptor.
+ */
+bool
+write_all(int fd, const std::string& buffer) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+}
+
+ProgressStore::ProgressStore(const std::string& file)
+    : file(file), lines(0), offset(0), device(0), inode(0) {
+}
+
+bool
+ProgressStore::load() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    int fd = openLocked(LOCK_SH);
+    if (fd < 0) {
+        // nothing was annotated yet if there is no journal
+        return errno == ENOENT;
+    }
+    bool read = readFrom(fd);
+    close(fd);
+    if (!read || !needsCompaction()) {
+        return read;
+    }
+
+    fd = openLocked(LOCK_EX);
+    if (fd < 0) {
+        return false;
+    }
+    bool compacted = readFrom(fd) && compactLocked();
+    close(fd);
+    return compacted;
+}
+
+std::unordered_set<std::string>
+ProgressStore::names() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recorded;
+}
+
+bool
+ProgressStore::append(const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    int fd = openLocked(LOCK_EX);
+    if (fd < 0) {
+        return false;
+    }
+    // merge names appended by other processes so that they are not appended again
+    bool appended = readFrom(fd);
+
+    std::string appendix;
+    std::unordered_set<std::string> batch;
+    for (const std::string& name : names) {
+        if (!recorded.count(name) && batch.insert(name).second) {
+            appendix += name + "\n";
+        }
+    }
+
+    struct stat info;
+    if (appended && !appendix.empty() && fstat(fd, &info) == 0) {
+        // terminate a partial last line so that it is not merged with the first name
+        if (info.st_size > offset) {
+            appendix = "\n" + appendix;
+        }
+        appended = write_all(fd, appendix) && fdatasync(fd) == 0;
+    }
+
+    // the appended names are recorded by reading them back
+    appended = readFrom(fd) && appended;
+    if (appended && needsCompaction()) {
+        appended = compactLocked();
+    }
+    close(fd);
+    return appended;
+}
+
+/**
+ * Open the journal and lock it, shared for reading or exclusively for appending,
+ * in which case it is created if necessary. Returns -1 on failure.
+ */
+int
+ProgressStore::openLocked(int lockType) {
+    const int flags = lockType == LOCK_SH ? O_RDONLY : (O_RDWR | O_CREAT | O_APPEND);
+    while (true) {
+        int fd = open(file.c_str(), flags, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock(fd, lockType) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        // the journal may have been replaced by a compaction while waiting for the lock
+        struct stat opened, current;
+        if (fstat(fd, &opened) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (stat(file.c_str(), &current) == 0 && opened.st_dev == current.st_dev && opened.st_ino == current.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Read the lines of the journal which were not read so far. The whole journal is
+ * read again if it was replaced. A partial last line is left for the next read.
+ * Requires the journal to be locked.
+ */
+bool
+ProgressStore::readFrom(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        return false;
+    }
+    if (info.st_dev != device || info.st_ino != inode || info.st_size < offset) {
+        device = info.st_dev;
+        inode = info.st_ino;
+        offset = 0;
+        lines = 0;
+    }
+
+    std::string buffer(info.st_size - offset, '\0');
+    size_t done = 0;
+    while (done < buffer.size()) {
+        ssize_t n = pread(fd, &buffer[done], buffer.size() - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+
+    size_t start = 0;
+    for (size_t end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n', start)) {
+        std::string name = buffer.substr(start, end - start);
+        if (!name.empty() && name[name.size() - 1] == '\r') {
+            name.erase(name.size() - 1);
+        }
+        lines++;
+        if (!name.empty() && recorded.insert(name).second) {
+            order.push_back(name);
+        }
+        start = end + 1;
+    }
+    offset += start;
+    return true;
+}
+
+/**
+ * Check if the journal contains too many redundant lines.
+ */
+bool
+ProgressStore::needsCompaction() const {
+    return lines > 2 * order.size() + COMPACTION_SLACK;
+}
+
+/**
+ * Atomically replace the journal by one containing every name once.
+ * Requires the journal to be locked exclusively and completely read.
+ */
+bool
+ProgressStore::compactLocked() {
+    std::string content;
+    for (const std::string& name : order) {
+        content += name + "\n";
+    }
+
+    const std::string temporary = file + ".tmp";
+    int out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        return false;
+    }
+    bool written = write_all(out, content) && fsync(out) == 0;
+    written = close(out) == 0 && written;
+
+    struct stat info;
+    if (!written || stat(temporary.c_str(), &info) != 0 || std::rename(temporary.c_str(), file.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    // continue with the compacted journal, processes waiting for the lock
+    // of the replaced journal detect the replacement and open it
+    device = info.st_dev;
+    inode = info.st_ino;
+    offset = content.size();
+    lines = order.size();
+    return true;
+}
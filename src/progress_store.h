@@ -0,0 +1,66 @@
+#ifndef PROGRESS_STORE_H
+#define PROGRESS_STORE_H
+
+#include <sys/types.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Journal of the names of annotated images (.annotated.txt) with hashed lookup.
+ *
+ * The journal is an append-only log with one name per line. Duplicate lines and a
+ * partial last line, e.g. left by a crash, are tolerated. If the log contains many
+ * redundant lines it is compacted by atomically replacing it with a log of the unique
+ * names in the order they were first recorded.
+ *
+ * The store may be used by several threads and the journal may be shared with other
+ * processes (e.g. batch tools or another annotation session on the same output
+ * directory): every access locks the journal file with flock, names appended by
+ * other processes are merged before appending and a journal replaced by a compaction
+ * of another process is detected and re-read.
+ */
+class ProgressStore {
+public:
+    explicit ProgressStore(const std::string& file);
+
+    /**
+     * Read the journal and compact it if it contains many redundant lines.
+     */
+    bool load();
+
+    /**
+     * Retrieve the names of all annotated images.
+     */
+    std::unordered_set<std::string> names() const;
+
+    /**
+     * Record images as annotated and append the names not yet recorded to the journal.
+     */
+    bool append(const std::vector<std::string>& names);
+
+private:
+    int openLocked(int lockType);
+    bool readFrom(int fd);
+    bool needsCompaction() const;
+    bool compactLocked();
+
+    std::string file;
+
+    mutable std::mutex mutex;
+    std::unordered_set<std::string> recorded;
+    // names in the order they were recorded first
+    std::vector<std::string> order;
+
+    // lines in the journal including duplicates
+    size_t lines;
+    // bytes of the journal which were read, always at the start of a line
+    off_t offset;
+    // identity of the journal file which was read
+    dev_t device;
+    ino_t inode;
+};
+
+#endif // PROGRESS_STORE_H
@@ -0,0 +1,55 @@
+#include "pyramid.h"
+
+#include <algorithm>
+
+cv::Size
+level_size(const cv::Size& size, int level) {
+    cv::Size result = size;
+    for (int l = 0; l < level; l++) {
+        result = cv::Size((result.width + 1) / 2, (result.height + 1) / 2);
+    }
+    return result;
+}
+
+cv::Rect
+to_level(const cv::Rect& region, int level) {
+    if (region.empty()) {
+        return cv::Rect();
+    }
+    // rounds towards negative infinity also for negative coordinates
+    const int x0 = region.x >> level;
+    const int y0 = region.y >> level;
+    const int x1 = ((region.x + region.width - 1) >> level) + 1;
+    const int y1 = ((region.y + region.height - 1) >> level) + 1;
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+void
+downsample_mean(const cv::Mat& source, cv::Mat& destination) {
+    for (int y = 0; y < destination.rows; y++) {
+        const cv::Vec3b* top = source.ptr<cv::Vec3b>(std::min(2 * y, source.rows - 1));
+        const cv::Vec3b* bottom = source.ptr<cv::Vec3b>(std::min(2 * y + 1, source.rows - 1));
+        cv::Vec3b* out = destination.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < destination.cols; x++) {
+            const int left = std::min(2 * x, source.cols - 1);
+            const int right = std::min(2 * x + 1, source.cols - 1);
+            for (int c = 0; c < 3; c++) {
+                out[x][c] = static_cast<uchar>((top[left][c] + top[right][c] + bottom[left][c] + bottom[right][c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+void
+downsample_max(const cv::Mat& source, cv::Mat& destination) {
+    for (int y = 0; y < destination.rows; y++) {
+        const uchar* top = source.ptr<uchar>(std::min(2 * y, source.rows - 1));
+        const uchar* bottom = source.ptr<uchar>(std::min(2 * y + 1, source.rows - 1));
+        uchar* out = destination.ptr<uchar>(y);
+        for (int x = 0; x < destination.cols; x++) {
+            const int left = std::min(2 * x, source.cols - 1);
+            const int right = std::min(2 * x + 1, source.cols - 1);
+            out[x] = std::max(std::max(top[left], top[right]), std::max(bottom[left], bottom[right]));
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <opencv2/opencv.hpp>
+
+/**
+ * Helpers for the levels of image pyramids.
+ *
+ * Level 0 is the image itself and every following level halves the resolution,
+ * rounding up. Image pixels of a level are the mean of the 2x2 pixels they cover.
+ * GT pixels are the maximum label, so that thin marks stay visible when zoomed out.
+ */
+
+/**
+ * Compute the size of a level of an image.
+ */
+cv::Size
+level_size(const cv::Size& size, int level);
+
+/**
+ * Map a region in coordinates of level 0 to the pixels of a level covering it.
+ */
+cv::Rect
+to_level(const cv::Rect& region, int level);
+
+/**
+ * Downsample a BGR image into the destination by averaging 2x2 pixels: pixel (x, y) of
+ * the destination covers the pixels (2x, 2y) to (2x+1, 2y+1) of the source. Pixels
+ * outside the source are replaced by its border.
+ */
+void
+downsample_mean(const cv::Mat& source, cv::Mat& destination);
+
+/**
+ * Downsample a GT into the destination by the maximum label of 2x2 pixels.
+ */
+void
+downsample_max(const cv::Mat& source, cv::Mat& destination);
+
+#endif // PYRAMID_H
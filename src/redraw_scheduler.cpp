@@ -0,0 +1,63 @@
+#include "redraw_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+// duration without changes after which the event loop is woken up less frequently
+const std::chrono::seconds ACTIVE_PERIOD(1);
+// timeout of the event loop if the user is inactive
+const int IDLE_TIMEOUT_MS = 250;
+
+}
+
+RedrawScheduler::RedrawScheduler(int refreshRate)
+    : dirty(true), lastPresent(), lastChange(Clock::now()), asleep(false) {
+    setRefreshRate(refreshRate);
+}
+
+void
+RedrawScheduler::setRefreshRate(int refreshRate) {
+    interval = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / std::max(refreshRate, 1);
+}
+
+void
+RedrawScheduler::invalidate() {
+    dirty = true;
+    lastChange = Clock::now();
+}
+
+bool
+RedrawScheduler::due() const {
+    return dirty && Clock::now() - lastPresent >= interval;
+}
+
+void
+RedrawScheduler::presented() {
+    dirty = false;
+    lastPresent = Clock::now();
+}
+
+void
+RedrawScheduler::woken() {
+    asleep = false;
+}
+
+int
+RedrawScheduler::timeout() {
+    const Clock::time_point now = Clock::now();
+    const int intervalMs = std::max(1, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(interval).count()));
+
+    if (dirty) {
+        // wait until the next frame may be displayed
+        Clock::duration remaining = interval - (now - lastPresent);
+        return std::max(1, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+    }
+    if (now - lastChange < ACTIVE_PERIOD) {
+        // keep a short timeout while the user is active because changes from callbacks
+        // can only be displayed once the event loop returns
+        return intervalMs;
+    }
+    asleep = true;
+    return IDLE_TIMEOUT_MS;
+}
@@ -0,0 +1,72 @@
+#ifndef REDRAW_SCHEDULER_H
+#define REDRAW_SCHEDULER_H
+
+#include <chrono>
+
+/**
+ * Decides when the view has to be rendered and displayed again.
+ *
+ * Everything changing the view (mouse events, trackbars, keys) invalidates it.
+ * A frame is only rendered if the view is invalid and frames are displayed at
+ * most at the refresh rate, which throttles rendering during strokes where mouse
+ * events arrive much faster. Without any changes nothing is rendered at all and
+ * the event loop is woken up less frequently.
+ */
+class RedrawScheduler {
+public:
+    explicit RedrawScheduler(int refreshRate = 60);
+
+    /**
+     * Set the maximal number of frames displayed per second.
+     */
+    void setRefreshRate(int refreshRate);
+
+    /**
+     * Mark the view as changed so that it is rendered again.
+     */
+    void invalidate();
+
+    /**
+     * Check if a frame should be rendered and displayed now.
+     */
+    bool due() const;
+
+    /**
+     * Notify the scheduler that a frame was displayed.
+     */
+    void presented();
+
+    /**
+     * Compute the time in milliseconds to wait for events before a frame may become due.
+     * The event loop is considered sleeping until woken is called if the long timeout of
+     * an inactive user is returned.
+     */
+    int timeout();
+
+    /**
+     * Notify the scheduler that the event loop stopped waiting for events.
+     */
+    void woken();
+
+    /**
+     * Check if the event loop waits with the long timeout of an inactive user, in which
+     * case frames requested by callbacks are not displayed before it wakes up.
+     */
+    bool sleeping() const { return asleep; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // minimal duration between two displayed frames
+    Clock::duration interval;
+    // if the view changed since the last frame
+    bool dirty;
+    // time the last frame was displayed
+    Clock::time_point lastPresent;
+    // time the view was changed the last time
+    Clock::time_point lastChange;
+    // if the event loop waits with the long timeout
+    bool asleep;
+};
+
+#endif // REDRAW_SCHEDULER_H
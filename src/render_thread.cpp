@@ -0,0 +1,116 @@
+#include "render_thread.h"
+
+#include "allocation_counter.h"
+#include "geometry.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+RenderThread::RenderThread(bool reportAllocations, unsigned threads, bool pinThreads)
+    : allocations(0), compositor(threads, pinThreads, [this]() { count_allocations_in(allocations); }),
+      reportAllocations(reportAllocations), hasPending(false), stop(false), idle(true),
+      middle(1), back(0), front(2) {
+    worker = std::thread(&RenderThread::work, this);
+}
+
+RenderThread::~RenderThread() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    submitted.notify_all();
+    worker.join();
+}
+
+void
+RenderThread::submit(const ViewState& state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the edits of a state which is replaced before it was rendered are still needed
+        const cv::Rect edited = hasPending && pending.generation == state.generation
+            ? unite(pending.edited, state.edited) : state.edited;
+        pending = state;
+        pending.edited = edited;
+        hasPending = true;
+        idle = false;
+    }
+    submitted.notify_all();
+}
+
+bool
+RenderThread::latest(cv::Mat& frame) {
+    if (!(middle.load() & FRESH)) {
+        return false;
+    }
+    front = middle.exchange(front) & ~FRESH;
+    frame = frames[front].mat();
+    return true;
+}
+
+bool
+RenderThread::wait(cv::Mat& frame, int timeout) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        published.wait_for(lock, std::chrono::milliseconds(timeout),
+                           [this]() { return (middle.load() & FRESH) != 0; });
+    }
+    return latest(frame);
+}
+
+bool
+RenderThread::busy() const {
+    return !idle;
+}
+
+/**
+ * Main loop of the thread rendering the newest submitted state.
+ */
+void
+RenderThread::work() {
+    bool rendered = false;
+    unsigned generation = 0;
+    // frames are measured together with the allocations of the compositing threads
+    count_allocations_in(allocations);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        submitted.wait(lock, [this]() { return stop || hasPending; });
+        if (stop) {
+            return;
+        }
+        ViewState state = std::move(pending);
+        hasPending = false;
+        lock.unlock();
+
+        const size_t allocated = allocation_count();
+
+        // nothing rendered for another image is reused
+        if (!rendered || state.generation != generation) {
+            compositor.reset();
+            generation = state.generation;
+            rendered = true;
+        } else if (!state.edited.empty()) {
+            compositor.invalidate(state.edited);
+        }
+        const cv::Mat view = compositor.render(*state.image, *state.imageGT, state.zoomRect, state.viewSize,
+                                               state.overlay, state.defects, state.marker);
+
+        cv::Mat& frame = frames[back].resize(view.size(), view.type());
+        view.copyTo(frame);
+        // publish the frame, the previous middle buffer becomes the next back buffer
+        back = middle.exchange(back | FRESH) & ~FRESH;
+
+        if (reportAllocations && allocation_count() != allocated) {
+            std::cout << "Rendering a frame allocated " << allocation_count() - allocated << " times" << std::endl;
+        }
+
+        // release the image before waiting, it may not be displayed anymore
+        state = ViewState();
+        lock.lock();
+        if (!hasPending) {
+            idle = true;
+        }
+        published.notify_all();
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <opencv2/opencv.hpp>
+
+#include "allocation_counter.h"
+#include "compositor.h"
+#include "frame_buffer.h"
+#include "tiled_gt.h"
+#include "tiled_image.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Everything determining a frame of the view.
+ */
+struct ViewState {
+    std::shared_ptr<TiledImage> image;
+    std::shared_ptr<TiledGT> imageGT;
+    // changes whenever another image is displayed, so that nothing rendered before is reused
+    unsigned generation;
+    cv::Rect zoomRect;
+    cv::Size viewSize;
+    int overlay;
+    // defects to draw or nullptr
+    const std::vector<cv::Rect>* defects;
+    // marker around the cursor in view coordinates
+    cv::Rect marker;
+    // region of the GT edited since the previous state was submitted (image coordinates)
+    cv::Rect edited;
+};
+
+/**
+ * Thread rendering the view in the background with a Compositor, so that the GUI
+ * thread keeps handling mouse and key events while a frame is composited.
+ *
+ * The GUI thread submits the current view state. If the thread is still busy the
+ * state replaces any state which was not started yet, so that only the newest
+ * state is rendered. Rendered frames are handed back through a lock-free triple
+ * buffer: the thread renders into the back buffer and swaps it with the middle
+ * buffer, the GUI thread swaps the middle buffer with the front buffer it displays
+ * if a new frame is ready. Neither of them ever waits for the other.
+ */
+class RenderThread {
+public:
+    /**
+     * Frames whose rendering allocated memory on the thread or its compositing threads
+     * are reported if reportAllocations is set.
+     * The frames are composited by the given number of threads, or one per core if threads is 0,
+     * which are pinned to cores if pinThreads is set.
+     */
+    explicit RenderThread(bool reportAllocations = false, unsigned threads = 0, bool pinThreads = false);
+    ~RenderThread();
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    /**
+     * Request a frame of a view state. Edits of a replaced state are kept.
+     */
+    void submit(const ViewState& state);
+
+    /**
+     * Retrieve the newest frame if one was rendered since the last call.
+     * The frame stays valid until the next call returning true.
+     */
+    bool latest(cv::Mat& frame);
+
+    /**
+     * Wait at most timeout milliseconds for a frame which was not yet retrieved
+     * and retrieve it like latest.
+     */
+    bool wait(cv::Mat& frame, int timeout);
+
+    /**
+     * Check if a submitted state was not yet published as frame.
+     */
+    bool busy() const;
+
+private:
+    // flag of the middle buffer marking a frame which was not yet retrieved
+    static const int FRESH = 4;
+
+    void work();
+
+    // allocations of the thread and the compositing threads, which outlives them
+    AllocationCounter allocations;
+    Compositor compositor;
+    bool reportAllocations;
+
+    std::mutex mutex;
+    // wakes up the thread if a state was submitted
+    std::condition_variable submitted;
+    // wakes up threads waiting for a frame if one was published
+    std::condition_variable published;
+    ViewState pending;
+    bool hasPending;
+    bool stop;
+    // if every submitted state was published
+    std::atomic<bool> idle;
+
+    FrameBuffer frames[3];
+    // index of the middle buffer together with the FRESH flag
+    std::atomic<int> middle;
+    // buffer rendered into, only used by the thread
+    int back;
+    // buffer displayed, only used by the GUI thread
+    int front;
+
+    std::thread worker;
+};
+
+#endif // RENDER_THREAD_H
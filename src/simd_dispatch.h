@@ -0,0 +1,42 @@
+#ifndef SIMD_DISPATCH_H
+#define SIMD_DISPATCH_H
+
+/**
+ * Selection of SIMD implementations of a kernel at runtime.
+ *
+ * SSE2 kernels are compiled if the target supports SSE2. AVX2 kernels are compiled
+ * for x86 with GCC compatible compilers through __attribute__((target("avx2"))) and
+ * only used if the processor supports AVX2, so that the binary runs everywhere.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2(function) function
+#else
+#define SIMD_SSE2(function) nullptr
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_AVX2
+#include <immintrin.h>
+#define SIMD_AVX2_FUNCTION(function) function
+#else
+#define SIMD_AVX2_FUNCTION(function) nullptr
+#endif
+
+/**
+ * Choose the fastest implementation supported by the processor. Implementations
+ * which were not compiled are passed as nullptr, e.g. through SIMD_SSE2(function).
+ */
+template<typename Function>
+Function
+select_implementation(Function avx2, Function sse2, Function scalar) {
+#if defined(SIMD_AVX2)
+    if (avx2 && __builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+#endif
+    return sse2 ? sse2 : scalar;
+}
+
+#endif // SIMD_DISPATCH_H
@@ -0,0 +1,158 @@
+#include "stroke_rasterizer.h"
+
+#include "geometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+StrokeRasterizer::StrokeRasterizer()
+    : stroking(false), strokeLabel(0) {
+    // enough for the events of a frame, so that queuing does not allocate
+    segments.reserve(256);
+}
+
+void
+StrokeRasterizer::begin(const cv::Point& position, const BrushStamp& stamp, uchar label) {
+    Segment segment = { position, position, &stamp, label, true };
+    segments.push_back(segment);
+    stroking = true;
+    strokeLabel = label;
+    strokeEnd = position;
+}
+
+void
+StrokeRasterizer::extend(const cv::Point& position, const BrushStamp& stamp, uchar label) {
+    if (!stroking || label != strokeLabel) {
+        begin(position, stamp, label);
+        return;
+    }
+    Segment segment = { strokeEnd, position, &stamp, label, false };
+    segments.push_back(segment);
+    strokeEnd = position;
+}
+
+void
+StrokeRasterizer::end() {
+    stroking = false;
+}
+
+cv::Rect
+StrokeRasterizer::rasterize(TiledGT& imageGT, UndoHistory* history) {
+    const cv::Rect image(cv::Point(0, 0), imageGT.size());
+    const int tileSize = imageGT.tileSize();
+    cv::Rect painted;
+
+    // every segment is painted a tile at a time, so that the mask never exceeds a tile
+    // however far the cursor moved between two frames
+    for (const Segment& segment : segments) {
+        if (history && segment.starts) {
+            history->begin();
+        }
+        const cv::Rect region = bounds(segment) & image;
+        if (region.empty()) {
+            continue;
+        }
+        for (int row = region.y / tileSize; row <= (region.y + region.height - 1) / tileSize; row++) {
+            for (int column = region.x / tileSize; column <= (region.x + region.width - 1) / tileSize; column++) {
+                // tiles inside the bounds of the segment but not reached by its stamps are left alone,
+                // so that they are neither cleared nor recorded for undoing nor copied
+                const cv::Rect part = region & cv::Rect(column * tileSize, row * tileSize, tileSize, tileSize);
+                int first, last;
+                if (!reach(segment, part, first, last)) {
+                    continue;
+                }
+                cv::Mat& mask = maskBuffer.resize(part.size(), CV_8UC1);
+                mask.setTo(0);
+                if (!draw(segment, part, first, last, mask)) {
+                    continue;
+                }
+                if (history) {
+                    history->record(imageGT, part, segment.label);
+                }
+                imageGT.fill(part, mask, segment.label);
+                painted = unite(painted, part);
+            }
+        }
+    }
+
+    segments.clear();
+    return painted;
+}
+
+/**
+ * Compute the region (image coordinates) painted by a segment.
+ */
+cv::Rect
+StrokeRasterizer::bounds(const Segment& segment) {
+    const cv::Rect stamp = segment.stamp->bounds();
+    return (stamp + segment.from) | (stamp + segment.to);
+}
+
+/**
+ * Find the positions [first, last] of a segment whose stamps may reach into a region
+ * (image coordinates). Returns false if there are none.
+ */
+bool
+StrokeRasterizer::reach(const Segment& segment, const cv::Rect& region, int& first, int& last) {
+    // the stamp is applied at every pixel of the line, consecutive stamps are at most
+    // one pixel apart in each direction so that no gaps remain
+    const cv::Rect stamp = segment.stamp->bounds();
+    const cv::Point delta = segment.to - segment.from;
+    const int steps = std::max(std::abs(delta.x), std::abs(delta.y));
+    if (steps == 0) {
+        first = 0;
+        last = 0;
+        return !((stamp + segment.from) & region).empty();
+    }
+
+    // the positions are found by clipping the line to the region grown by the stamp and a pixel for rounding
+    const double left = region.x - (stamp.x + stamp.width) - 1;
+    const double right = region.x + region.width - stamp.x + 1;
+    const double top = region.y - (stamp.y + stamp.height) - 1;
+    const double bottom = region.y + region.height - stamp.y + 1;
+    double t0 = 0.0;
+    double t1 = 1.0;
+    if (!clip(-delta.x, segment.from.x - left, t0, t1) || !clip(delta.x, right - segment.from.x, t0, t1)
+            || !clip(-delta.y, segment.from.y - top, t0, t1) || !clip(delta.y, bottom - segment.from.y, t0, t1)) {
+        return false;
+    }
+    first = std::max(0, static_cast<int>(std::floor(t0 * steps)));
+    last = std::min(steps, static_cast<int>(std::ceil(t1 * steps)));
+    return first <= last;
+}
+
+/**
+ * Draw the stamps at the positions [first, last] of a segment (see reach) into a mask
+ * covering a region (image coordinates). Returns false if none of them covered the mask.
+ */
+bool
+StrokeRasterizer::draw(const Segment& segment, const cv::Rect& region, int first, int last, cv::Mat& mask) {
+    const cv::Point delta = segment.to - segment.from;
+    const double steps = std::max(1, std::max(std::abs(delta.x), std::abs(delta.y)));
+    bool covered = false;
+    for (int i = first; i <= last; i++) {
+        const cv::Point position(segment.from.x + cvRound(delta.x * i / steps),
+                                 segment.from.y + cvRound(delta.y * i / steps));
+        covered = segment.stamp->apply(position - region.tl(), mask) || covered;
+    }
+    return covered;
+}
+
+/**
+ * Restrict the parameters [t0, t1] of a line to those satisfying direction * t <= distance.
+ * Returns false if no parameter is left.
+ */
+bool
+StrokeRasterizer::clip(double direction, double distance, double& t0, double& t1) {
+    if (direction == 0.0) {
+        return distance >= 0.0;
+    }
+    const double t = distance / direction;
+    if (direction < 0.0) {
+        t0 = std::max(t0, t);
+    } else {
+        t1 = std::min(t1, t);
+    }
+    return t0 <= t1;
+}
@@ -0,0 +1,78 @@
+#ifndef STROKE_RASTERIZER_H
+#define STROKE_RASTERIZER_H
+
+#include <opencv2/opencv.hpp>
+
+#include "brush.h"
+#include "frame_buffer.h"
+#include "tiled_gt.h"
+#include "undo_history.h"
+
+#include <vector>
+
+/**
+ * Queue of brush strokes painted into a GT once per frame.
+ *
+ * Mouse events only append their position in image coordinates, so that handling
+ * an event costs as little as possible. rasterize paints the queued samples once per
+ * frame: the stamp of the brush is applied at every pixel of the line between
+ * consecutive samples of a stroke, so that strokes are continuous independent of the
+ * speed of the mouse. Segments are painted a tile of the GT at a time, visiting only
+ * the positions of the line reaching into the tile, so that the memory needed does
+ * not depend on the length of a segment.
+ */
+class StrokeRasterizer {
+public:
+    StrokeRasterizer();
+
+    /**
+     * Start a new stroke with a label at a position (image coordinates).
+     * The stamp has to stay valid until the stroke was rasterized.
+     */
+    void begin(const cv::Point& position, const BrushStamp& stamp, uchar label);
+
+    /**
+     * Continue the current stroke to a position, or start a new one if there is no
+     * stroke with that label.
+     */
+    void extend(const cv::Point& position, const BrushStamp& stamp, uchar label);
+
+    /**
+     * End the current stroke, e.g. because the mouse button was released.
+     */
+    void end();
+
+    /**
+     * Paint the queued samples into a GT and return the painted region, or an empty
+     * rectangle if nothing was queued. If a history is given every stroke is recorded
+     * as a step of it.
+     */
+    cv::Rect rasterize(TiledGT& imageGT, UndoHistory* history = nullptr);
+
+private:
+    // segment of a stroke painted by a brush
+    struct Segment {
+        cv::Point from;
+        cv::Point to;
+        const BrushStamp* stamp;
+        uchar label;
+        // if the segment starts a stroke
+        bool starts;
+    };
+
+    static cv::Rect bounds(const Segment& segment);
+    static bool reach(const Segment& segment, const cv::Rect& region, int& first, int& last);
+    static bool draw(const Segment& segment, const cv::Rect& region, int first, int last, cv::Mat& mask);
+    static bool clip(double direction, double distance, double& t0, double& t1);
+
+    std::vector<Segment> segments;
+    // end of the current stroke
+    bool stroking;
+    uchar strokeLabel;
+    cv::Point strokeEnd;
+
+    // pixels of a tile painted by a segment
+    FrameBuffer maskBuffer;
+};
+
+#endif // STROKE_RASTERIZER_H
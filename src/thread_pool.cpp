@@ -0,0 +1,152 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/**
+ * Retrieve the cores the process may run on, which may be restricted by its affinity
+ * mask or a cpuset. Returns false if they are not known.
+ */
+bool
+available_cores(std::vector<int>& cores) {
+    cores.clear();
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int core = 0; core < CPU_SETSIZE; core++) {
+            if (CPU_ISSET(core, &allowed)) {
+                cores.push_back(core);
+            }
+        }
+    }
+#endif
+    return !cores.empty();
+}
+
+}
+
+ThreadPool::ThreadPool(unsigned threads, bool pin, std::function<void()> setup)
+    : generation(0), active(0), stop(false), function(nullptr), task(nullptr), count(0), next(0), remaining(0) {
+    std::vector<int> available;
+    const bool known = available_cores(available);
+    if (threads == 0) {
+        threads = known ? static_cast<unsigned>(available.size()) : std::max(1u, std::thread::hardware_concurrency());
+    }
+    // pinning only helps if every worker gets a core of its own
+    if (pin && known && available.size() >= threads) {
+        cores = available;
+    }
+    // the calling thread works on the tasks as well
+    for (unsigned i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::work, this, static_cast<size_t>(i), setup));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    started.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void
+ThreadPool::dispatch(size_t taskCount, Function taskFunction, void* taskData) {
+    if (taskCount == 0) {
+        return;
+    }
+    if (workers.empty() || taskCount == 1) {
+        for (size_t i = 0; i < taskCount; i++) {
+            taskFunction(taskData, i);
+        }
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // a worker which joined the previous run late still reads its task
+        finished.wait(lock, [this]() { return active == 0; });
+        function = taskFunction;
+        task = taskData;
+        count = taskCount;
+        next = 0;
+        remaining = taskCount;
+        generation++;
+    }
+    started.notify_all();
+
+    execute(taskFunction, taskData, taskCount);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() { return remaining == 0; });
+}
+
+/**
+ * Main loop of a worker thread.
+ */
+void
+ThreadPool::work(size_t index, std::function<void()> setup) {
+#ifdef __linux__
+    // keep the worker on its own core so that its caches stay warm between frames,
+    // the calling thread usually runs on the first core
+    if (!cores.empty()) {
+        const int core = cores[index % cores.size()];
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            std::cout << "Error! Could not pin worker[" << index << "] to core[" << core << "]!" << std::endl;
+        }
+    }
+#endif
+    if (setup) {
+        setup();
+    }
+
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        started.wait(lock, [&]() { return stop || generation != seen; });
+        if (stop) {
+            return;
+        }
+        seen = generation;
+        const Function runFunction = function;
+        void* const runTask = task;
+        const size_t runCount = count;
+        active++;
+        lock.unlock();
+
+        execute(runFunction, runTask, runCount);
+
+        lock.lock();
+        active--;
+        finished.notify_all();
+    }
+}
+
+/**
+ * Claim and run tasks of the current run until none is left.
+ */
+void
+ThreadPool::execute(Function runFunction, void* runTask, size_t runCount) {
+    size_t i;
+    while ((i = next.fetch_add(1)) < runCount) {
+        runFunction(runTask, i);
+        if (remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.notify_all();
+        }
+    }
+}
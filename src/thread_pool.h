@@ -0,0 +1,86 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent pool of worker threads for data parallel work of every frame.
+ *
+ * run splits work into a number of tasks which are claimed one after another by the
+ * workers and the calling thread, so that faster threads take over the remaining tasks
+ * of slower ones. The workers are created once and sleep between runs. On request
+ * they are pinned to separate cores of the cores the process may run on, where
+ * supported. Running tasks does not allocate.
+ */
+class ThreadPool {
+public:
+    /**
+     * Create a pool using the given number of threads including the calling thread,
+     * or one thread per available core if threads is 0. The workers are pinned to
+     * cores if pin is set. Every worker calls setup before it runs tasks, e.g. to set
+     * up thread local state like the calling thread.
+     */
+    explicit ThreadPool(unsigned threads = 0, bool pin = false, std::function<void()> setup = nullptr);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Number of threads working on tasks including the calling thread.
+     */
+    size_t size() const { return workers.size() + 1; }
+
+    /**
+     * Call task(i) for every i in [0, count) in parallel and wait until all calls returned.
+     * Must not be called by multiple threads at the same time.
+     */
+    template<typename Task>
+    void run(size_t count, Task& task) {
+        dispatch(count, &ThreadPool::invoke<Task>, &task);
+    }
+
+private:
+    typedef void (*Function)(void* task, size_t index);
+
+    template<typename Task>
+    static void invoke(void* task, size_t index) {
+        (*static_cast<Task*>(task))(index);
+    }
+
+    void dispatch(size_t count, Function function, void* task);
+    void work(size_t index, std::function<void()> setup);
+    void execute(Function function, void* task, size_t count);
+
+    std::mutex mutex;
+    // wakes up the workers for a new run
+    std::condition_variable started;
+    // signals that the last task of a run finished or a worker left a run
+    std::condition_variable finished;
+    // incremented for every run so that workers notice new runs
+    unsigned long generation;
+    // number of workers working on the current run
+    size_t active;
+    bool stop;
+
+    // task of the current run
+    Function function;
+    void* task;
+    size_t count;
+    // next task index to claim
+    std::atomic<size_t> next;
+    // number of tasks which did not finish yet
+    std::atomic<size_t> remaining;
+
+    // cores the workers are pinned to, empty if they are not pinned
+    std::vector<int> cores;
+    std::vector<std::thread> workers;
+};
+
+#endif // THREAD_POOL_H
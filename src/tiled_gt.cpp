@@ -0,0 +1,497 @@
+#include "tiled_gt.h"
+
+#include <boost/filesystem.hpp>
+
+#include "bit_mask.h"
+#include "geometry.h"
+#include "pyramid.h"
+#include "tiled_image.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// first line of the description of a tiled GT followed by the version of the format
+const std::string GT_TILES_HEADER = "pixelwise-annotation-gt-tiles 1";
+
+int
+tiles_for(int length, int tileLength) {
+    return (length + tileLength - 1) / tileLength;
+}
+
+}
+
+TiledGT::TiledGT(const cv::Size& size, int tileSize, bool packed)
+    : baseSize(size), tileLength(tileSize), packed(packed), sources(1) {
+    levels.push_back(std::vector<Tile>(columns() * rows()));
+}
+
+TiledGT::TiledGT(const cv::Mat& imageGT, bool packed)
+    : baseSize(imageGT.size()), tileLength(DEFAULT_TILE_SIZE), packed(packed), sources(1) {
+    levels.push_back(std::vector<Tile>(columns() * rows()));
+    for (int row = 0; row < rows(); row++) {
+        for (int column = 0; column < columns(); column++) {
+            const cv::Mat labels = imageGT(tileRect(0, column, row));
+            if (cv::countNonZero(labels) > 0) {
+                levels[0][row * columns() + column].pixels = pack(labels);
+            }
+        }
+    }
+}
+
+std::shared_ptr<TiledGT>
+TiledGT::open(const std::string& path, bool packed) {
+    if (!is_tiled(path)) {
+        cv::Mat imageGT = cv::imread(path, cv::IMREAD_GRAYSCALE);
+        if (imageGT.empty()) {
+            return nullptr;
+        }
+        return std::make_shared<TiledGT>(imageGT, packed);
+    }
+
+    std::ifstream in((fs::path(path) / "tiles.txt").string());
+    std::string header;
+    int width, height, tileSize;
+    if (!std::getline(in, header) || header != GT_TILES_HEADER || !(in >> width >> height >> tileSize)
+            || width <= 0 || height <= 0 || tileSize <= 0) {
+        return nullptr;
+    }
+
+    std::shared_ptr<TiledGT> imageGT = std::make_shared<TiledGT>(cv::Size(width, height), tileSize, packed);
+    fs::directory_iterator end_itr;
+    for (fs::directory_iterator itr(path); itr != end_itr; itr++) {
+        // tiles are named <row>_<column>.png
+        int row, column;
+        char separator;
+        if (itr->path().extension() != ".png"
+                || std::sscanf(itr->path().stem().string().c_str(), "%d%c%d", &row, &separator, &column) != 3
+                || separator != '_' || row < 0 || row >= imageGT->rows() || column < 0 || column >= imageGT->columns()) {
+            continue;
+        }
+        cv::Mat labels = cv::imread(itr->path().string(), cv::IMREAD_GRAYSCALE);
+        if (labels.size() != imageGT->tileRect(0, column, row).size()) {
+            return nullptr;
+        }
+        imageGT->levels[0][row * imageGT->columns() + column].pixels = imageGT->pack(labels);
+    }
+    return imageGT;
+}
+
+std::shared_ptr<TiledGT>
+TiledGT::clone() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<TiledGT> copy = std::make_shared<TiledGT>(baseSize, tileLength, packed);
+    for (size_t i = 0; i < levels[0].size(); i++) {
+        if (!levels[0][i].pixels.empty()) {
+            copy->levels[0][i].pixels = levels[0][i].pixels.clone();
+        }
+    }
+    return copy;
+}
+
+cv::Size
+TiledGT::size(int level) const {
+    return level_size(baseSize, level);
+}
+
+int
+TiledGT::columns() const {
+    return tiles_for(baseSize.width, tileLength);
+}
+
+int
+TiledGT::rows() const {
+    return tiles_for(baseSize.height, tileLength);
+}
+
+bool
+TiledGT::tile(int column, int row, cv::Mat& labels) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const cv::Mat& pixels = levels[0][row * columns() + column].pixels;
+    if (pixels.empty()) {
+        return false;
+    }
+    const cv::Rect bounds = tileRect(0, column, row);
+    labels.create(bounds.size(), CV_8UC1);
+    unpack(pixels, cv::Rect(0, 0, bounds.width, bounds.height), labels);
+    return true;
+}
+
+cv::Mat
+TiledGT::share(int column, int row) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Tile& tile = levels[0][row * columns() + column];
+    tile.shared = !tile.pixels.empty();
+    return tile.pixels;
+}
+
+void
+TiledGT::exchange(int column, int row, cv::Mat& pixels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Tile& tile = levels[0][row * columns() + column];
+    cv::swap(tile.pixels, pixels);
+    // the pixels may still be shared by others who retrieved them
+    tile.shared = !tile.pixels.empty();
+    markStale(tileRect(0, column, row));
+}
+
+void
+TiledGT::fill(const cv::Rect& region, const cv::Mat& mask, uchar label) {
+    if (region.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (int row = region.y / tileLength; row <= (region.y + region.height - 1) / tileLength; row++) {
+        for (int column = region.x / tileLength; column <= (region.x + region.width - 1) / tileLength; column++) {
+            const cv::Rect bounds = tileRect(0, column, row);
+            const cv::Rect part = region & bounds;
+            const cv::Mat maskPart = mask(part - region.tl());
+            Tile& tile = levels[0][row * columns() + column];
+            if (tile.pixels.empty()) {
+                // erasing a tile which was never painted or painting nothing changes nothing
+                if (label == 0 || cv::countNonZero(maskPart) == 0) {
+                    continue;
+                }
+                tile.pixels = blank(bounds.size());
+            }
+            unshare(tile);
+            paint(tile.pixels, part - bounds.tl(), maskPart, label);
+            // a completely erased tile is black again without being stored
+            if (label == 0 && cv::countNonZero(tile.pixels) == 0) {
+                tile.pixels.release();
+            }
+        }
+    }
+
+    markStale(region);
+}
+
+/**
+ * Copy the pixels of a tile of level 0 before they are edited if they are shared.
+ */
+void
+TiledGT::unshare(Tile& tile) const {
+    if (tile.shared) {
+        tile.pixels = tile.pixels.clone();
+        tile.shared = false;
+    }
+}
+
+/**
+ * Mark the computed tiles of the coarser levels covering a region of level 0 as stale.
+ * Requires the mutex to be locked.
+ */
+void
+TiledGT::markStale(const cv::Rect& region) {
+    // the computed tiles of the coarser levels are downsampled again where they are read next
+    // and released if they become black
+    for (size_t level = 1; level < levels.size(); level++) {
+        const int l = static_cast<int>(level);
+        const cv::Size levelSize = size(l);
+        const cv::Rect levelRegion = to_level(region, l) & cv::Rect(0, 0, levelSize.width, levelSize.height);
+        const int levelColumns = tiles_for(levelSize.width, tileLength);
+        for (int row = levelRegion.y / tileLength; row <= (levelRegion.y + levelRegion.height - 1) / tileLength; row++) {
+            for (int column = levelRegion.x / tileLength; column <= (levelRegion.x + levelRegion.width - 1) / tileLength; column++) {
+                Tile& tile = levels[level][row * levelColumns + column];
+                if (tile.computed) {
+                    const cv::Rect bounds = tileRect(l, column, row);
+                    tile.stale = unite(tile.stale, (levelRegion & bounds) - bounds.tl());
+                }
+            }
+        }
+    }
+}
+
+bool
+TiledGT::labeled(int level, const cv::Rect& region) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return anyAllocated(level, region);
+}
+
+void
+TiledGT::read(int level, const cv::Rect& region, cv::Mat& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    copy(level, region, out);
+}
+
+/**
+ * Check if any tile of a level intersecting a region is allocated.
+ * Requires the mutex to be locked.
+ */
+bool
+TiledGT::anyAllocated(int level, const cv::Rect& region) {
+    addLevels(level);
+    if (region.empty()) {
+        return false;
+    }
+    bool content = false;
+    for (int row = region.y / tileLength; row <= (region.y + region.height - 1) / tileLength; row++) {
+        for (int column = region.x / tileLength; column <= (region.x + region.width - 1) / tileLength; column++) {
+            // all tiles are computed so that none of them is stale afterwards
+            content = !ensure(level, column, row).empty() || content;
+        }
+    }
+    return content;
+}
+
+/**
+ * Copy a region of a level into out. Requires the mutex to be locked.
+ */
+void
+TiledGT::copy(int level, const cv::Rect& region, cv::Mat& out) {
+    addLevels(level);
+    out.create(region.size(), CV_8UC1);
+    if (region.empty()) {
+        return;
+    }
+
+    for (int row = region.y / tileLength; row <= (region.y + region.height - 1) / tileLength; row++) {
+        for (int column = region.x / tileLength; column <= (region.x + region.width - 1) / tileLength; column++) {
+            const cv::Rect bounds = tileRect(level, column, row);
+            const cv::Rect part = bounds & region;
+            const cv::Mat& pixels = ensure(level, column, row);
+            cv::Mat outPart = out(part - region.tl());
+            if (pixels.empty()) {
+                outPart.setTo(0);
+            } else {
+                unpack(pixels, part - bounds.tl(), outPart);
+            }
+        }
+    }
+}
+
+std::string
+TiledGT::description() const {
+    std::ostringstream description;
+    description << GT_TILES_HEADER << "\n" << baseSize.width << " " << baseSize.height << " " << tileLength << "\n";
+    return description.str();
+}
+
+std::string
+TiledGT::tileName(int column, int row) {
+    return std::to_string(row) + "_" + std::to_string(column) + ".png";
+}
+
+cv::Mat
+TiledGT::toMat() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    cv::Mat imageGT(baseSize, CV_8UC1, cv::Scalar(0));
+    for (int row = 0; row < rows(); row++) {
+        for (int column = 0; column < columns(); column++) {
+            const cv::Mat& pixels = levels[0][row * columns() + column].pixels;
+            if (!pixels.empty()) {
+                const cv::Rect bounds = tileRect(0, column, row);
+                cv::Mat tileRegion = imageGT(bounds);
+                unpack(pixels, cv::Rect(0, 0, bounds.width, bounds.height), tileRegion);
+            }
+        }
+    }
+    return imageGT;
+}
+
+size_t
+TiledGT::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t total = 0;
+    for (const std::vector<Tile>& level : levels) {
+        for (const Tile& tile : level) {
+            total += tile.pixels.total();
+        }
+    }
+    return total;
+}
+
+int
+TiledGT::allocatedTiles() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    int allocated = 0;
+    for (const Tile& tile : levels[0]) {
+        allocated += tile.pixels.empty() ? 0 : 1;
+    }
+    return allocated;
+}
+
+size_t
+TiledGT::labeledPixels() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t pixels = 0;
+    for (const Tile& tile : levels[0]) {
+        if (tile.pixels.empty()) {
+            continue;
+        }
+        // bits outside of the tile are never set
+        pixels += packed ? count_bits(tile.pixels.data, tile.pixels.total()) : cv::countNonZero(tile.pixels);
+    }
+    return pixels;
+}
+
+/**
+ * Create the tile grids of all levels up to the given one, so that the grids
+ * are never reallocated while tiles are computed.
+ */
+void
+TiledGT::addLevels(int level) {
+    while (static_cast<int>(levels.size()) <= level) {
+        const cv::Size levelSize = size(static_cast<int>(levels.size()));
+        levels.push_back(std::vector<Tile>(tiles_for(levelSize.width, tileLength) * tiles_for(levelSize.height, tileLength)));
+        sources.push_back(FrameBuffer());
+    }
+}
+
+/**
+ * Retrieve the labels of a tile and compute the stale region of a tile of a coarser level.
+ * The returned matrix is empty if all labels of the tile are 0.
+ */
+const cv::Mat&
+TiledGT::ensure(int level, int column, int row) {
+    const cv::Size levelSize = size(level);
+    Tile& tile = levels[level][row * tiles_for(levelSize.width, tileLength) + column];
+    if (level == 0) {
+        return tile.pixels;
+    }
+
+    const cv::Rect bounds = tileRect(level, column, row);
+    if (!tile.computed) {
+        tile.computed = true;
+        tile.stale = cv::Rect(0, 0, bounds.width, bounds.height);
+    }
+    if (tile.stale.empty()) {
+        return tile.pixels;
+    }
+
+    const cv::Rect stale = tile.stale + bounds.tl();
+    tile.stale = cv::Rect();
+    const cv::Size finerSize = size(level - 1);
+    const cv::Rect finer = cv::Rect(2 * stale.x, 2 * stale.y, 2 * stale.width, 2 * stale.height)
+        & cv::Rect(0, 0, finerSize.width, finerSize.height);
+
+    // nothing has to be allocated where the finer level is black
+    if (!anyAllocated(level - 1, finer)) {
+        if (!tile.pixels.empty()) {
+            paint(tile.pixels, stale - bounds.tl(), 0);
+            if (cv::countNonZero(tile.pixels) == 0) {
+                tile.pixels.release();
+            }
+        }
+        return tile.pixels;
+    }
+
+    // copying the finer level may downsample its tiles as well, so every level has its own buffer
+    cv::Mat& source = sources[level].resize(finer.size(), CV_8UC1);
+    copy(level - 1, finer, source);
+    if (tile.pixels.empty()) {
+        tile.pixels = blank(bounds.size());
+    }
+    const cv::Rect part = stale - bounds.tl();
+    if (packed) {
+        cv::Mat& labels = downsampled.resize(part.size(), CV_8UC1);
+        downsample_max(source, labels);
+        for (int y = 0; y < part.height; y++) {
+            pack_bits(labels.ptr<uchar>(y), part.x, part.width, tile.pixels.ptr<uchar>(part.y + y));
+        }
+    } else {
+        cv::Mat target = tile.pixels(part);
+        downsample_max(source, target);
+    }
+    return tile.pixels;
+}
+
+/**
+ * Allocate a black tile. Packed tiles store a row of 64 bit words per row of labels.
+ */
+cv::Mat
+TiledGT::blank(const cv::Size& size) const {
+    if (packed) {
+        return cv::Mat(size.height, 8 * tiles_for(size.width, 64), CV_8UC1, cv::Scalar(0));
+    }
+    return cv::Mat(size, CV_8UC1, cv::Scalar(0));
+}
+
+/**
+ * Convert the labels of a tile into the format of the stored tiles.
+ */
+cv::Mat
+TiledGT::pack(const cv::Mat& labels) const {
+    if (!packed) {
+        return labels.clone();
+    }
+    cv::Mat pixels = blank(labels.size());
+    for (int y = 0; y < labels.rows; y++) {
+        pack_bits(labels.ptr<uchar>(y), 0, labels.cols, pixels.ptr<uchar>(y));
+    }
+    return pixels;
+}
+
+/**
+ * Copy the labels of a part (tile coordinates) of a stored tile into out.
+ */
+void
+TiledGT::unpack(const cv::Mat& pixels, const cv::Rect& part, cv::Mat& out) const {
+    if (!packed) {
+        pixels(part).copyTo(out);
+        return;
+    }
+    for (int y = 0; y < part.height; y++) {
+        unpack_bits(pixels.ptr<uchar>(part.y + y), part.x, part.width, out.ptr<uchar>(y));
+    }
+}
+
+/**
+ * Paint a part (tile coordinates) of a stored tile with a label.
+ */
+void
+TiledGT::paint(cv::Mat& pixels, const cv::Rect& part, uchar label) const {
+    if (!packed) {
+        cv::Mat target = pixels(part);
+        target.setTo(label);
+        return;
+    }
+    for (int y = 0; y < part.height; y++) {
+        set_bits(pixels.ptr<uchar>(part.y + y), part.x, part.width, label != 0);
+    }
+}
+
+/**
+ * Paint a part (tile coordinates) of a stored tile with a label where a mask of the size of the part is not 0.
+ */
+void
+TiledGT::paint(cv::Mat& pixels, const cv::Rect& part, const cv::Mat& mask, uchar label) const {
+    if (!packed) {
+        cv::Mat target = pixels(part);
+        target.setTo(label, mask);
+        return;
+    }
+    // the bits are set a run of masked pixels at a time
+    for (int y = 0; y < part.height; y++) {
+        const uchar* masked = mask.ptr<uchar>(y);
+        uchar* bits = pixels.ptr<uchar>(part.y + y);
+        int x = 0;
+        while (x < part.width) {
+            while (x < part.width && !masked[x]) {
+                x++;
+            }
+            const int start = x;
+            while (x < part.width && masked[x]) {
+                x++;
+            }
+            if (x > start) {
+                set_bits(bits, part.x + start, x - start, label != 0);
+            }
+        }
+    }
+}
+
+/**
+ * Compute the region of a level covered by a tile.
+ */
+cv::Rect
+TiledGT::tileRect(int level, int column, int row) const {
+    const cv::Size levelSize = size(level);
+    return cv::Rect(column * tileLength, row * tileLength, tileLength, tileLength)
+        & cv::Rect(0, 0, levelSize.width, levelSize.height);
+}
@@ -0,0 +1,181 @@
+#ifndef TILED_GT_H
+#define TILED_GT_H
+
+#include <opencv2/opencv.hpp>
+
+#include "frame_buffer.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Single channel label image (GT) stored in square tiles.
+ *
+ * Tiles are only allocated when they are painted for the first time and released
+ * again when they are erased completely, so that the memory used by a GT grows with
+ * the annotated area and not with the image. Tiles which are not allocated are
+ * implicitly black: they are neither blended, saved nor counted.
+ *
+ * Like TiledImage the GT provides the levels of its pyramid (see pyramid.h), which are
+ * computed per tile the first time they are read. Painting marks the touched region of
+ * every computed level as stale, so that only that region is downsampled again.
+ *
+ * GTs which only contain the labels 0 and 255 can be packed, storing a bit per label
+ * instead of a byte. Painting packed tiles sets and clears whole 64 bit words and
+ * reading expands the bits with SIMD instructions (see bit_mask.h). Every label
+ * other than 0 becomes 255 in packed GTs.
+ *
+ * All methods may be called from multiple threads, e.g. painting from the GUI while
+ * the view is rendered in the background.
+ *
+ * A GT is either stored as an image file or, for tiled images, as a directory with
+ * the extension ".tiles" containing:
+ *   tiles.txt: "pixelwise-annotation-gt-tiles 1" followed by the line
+ *              "<width> <height> <tile size>"
+ *   <row>_<column>.png: the allocated tiles
+ */
+class TiledGT {
+public:
+    // size of the tiles of new GTs
+    static const int DEFAULT_TILE_SIZE = 256;
+
+    /**
+     * Create a black GT without allocating any tile.
+     */
+    explicit TiledGT(const cv::Size& size, int tileSize = DEFAULT_TILE_SIZE, bool packed = false);
+
+    /**
+     * Split a GT into tiles. Black tiles are not allocated.
+     */
+    explicit TiledGT(const cv::Mat& imageGT, bool packed = false);
+
+    TiledGT(const TiledGT&) = delete;
+    TiledGT& operator=(const TiledGT&) = delete;
+
+    /**
+     * Open a GT file or a tiled GT directory. Returns nullptr on failure.
+     */
+    static std::shared_ptr<TiledGT> open(const std::string& path, bool packed = false);
+
+    /**
+     * Create a copy of the allocated tiles, e.g. to save it while it is edited further.
+     */
+    std::shared_ptr<TiledGT> clone() const;
+
+    cv::Size size(int level = 0) const;
+    int tileSize() const { return tileLength; }
+    int columns() const;
+    int rows() const;
+
+    /**
+     * Copy the labels of a tile of level 0 into labels.
+     * Returns false if the tile is not allocated.
+     */
+    bool tile(int column, int row, cv::Mat& labels) const;
+
+    /**
+     * Share the stored pixels of a tile of level 0, e.g. to keep them for undoing edits.
+     * The pixels are empty if the tile is not allocated. The shared pixels are never
+     * modified, the tile is copied before it is edited the next time.
+     */
+    cv::Mat share(int column, int row);
+
+    /**
+     * Exchange the stored pixels of a tile of level 0 with pixels previously retrieved
+     * through share or exchange. The pixels of the tile are shared afterwards.
+     */
+    void exchange(int column, int row, cv::Mat& pixels);
+
+    /**
+     * Paint the pixels of a region (coordinates of level 0) with a label where a mask
+     * covering exactly that region is not 0. The region has to be inside the GT.
+     */
+    void fill(const cv::Rect& region, const cv::Mat& mask, uchar label);
+
+    /**
+     * Check if any tile of a level intersecting a region (level coordinates) is allocated,
+     * i.e. if the region may contain labels other than 0.
+     */
+    bool labeled(int level, const cv::Rect& region);
+
+    /**
+     * Copy a region (level coordinates) of a level into out.
+     * The region has to be inside the level.
+     */
+    void read(int level, const cv::Rect& region, cv::Mat& out);
+
+    /**
+     * Content of the tiles.txt of a tiled GT directory.
+     */
+    std::string description() const;
+
+    /**
+     * Name of the file of a tile in a tiled GT directory.
+     */
+    static std::string tileName(int column, int row);
+
+    /**
+     * Assemble the complete GT of level 0.
+     */
+    cv::Mat toMat() const;
+
+    /**
+     * Memory used by allocated tiles of all levels.
+     */
+    size_t bytes() const;
+
+    /**
+     * Number of allocated tiles of level 0.
+     */
+    int allocatedTiles() const;
+
+    /**
+     * Number of pixels with a label other than 0.
+     */
+    size_t labeledPixels() const;
+
+private:
+    struct Tile {
+        Tile() : computed(false), shared(false) {}
+
+        // labels of the tile, empty if all labels are 0, packed into bits for packed GTs
+        cv::Mat pixels;
+        // region of the tile (tile coordinates) which has to be downsampled again
+        cv::Rect stale;
+        // if the tile of a coarser level was computed
+        bool computed;
+        // if the pixels are shared and have to be copied before they are edited
+        bool shared;
+    };
+
+    void addLevels(int level);
+    bool anyAllocated(int level, const cv::Rect& region);
+    void copy(int level, const cv::Rect& region, cv::Mat& out);
+    const cv::Mat& ensure(int level, int column, int row);
+    cv::Rect tileRect(int level, int column, int row) const;
+    cv::Mat blank(const cv::Size& size) const;
+    cv::Mat pack(const cv::Mat& labels) const;
+    void unpack(const cv::Mat& pixels, const cv::Rect& part, cv::Mat& out) const;
+    void paint(cv::Mat& pixels, const cv::Rect& part, uchar label) const;
+    void paint(cv::Mat& pixels, const cv::Rect& part, const cv::Mat& mask, uchar label) const;
+    void markStale(const cv::Rect& region);
+    void unshare(Tile& tile) const;
+
+    cv::Size baseSize;
+    int tileLength;
+    // if tiles store a bit per label
+    bool packed;
+    // guards the tiles of all levels
+    mutable std::mutex mutex;
+    // tiles of every level in row major order
+    std::vector<std::vector<Tile>> levels;
+    // labels of the finer level a tile of every level is downsampled from, reused so that
+    // downsampling does not allocate (see ensure)
+    std::vector<FrameBuffer> sources;
+    // downsampled labels of a packed tile before they are packed
+    FrameBuffer downsampled;
+};
+
+#endif // TILED_GT_H
@@ -0,0 +1,224 @@
+#include "tiled_image.h"
+
+#include <boost/filesystem.hpp>
+
+#include "pyramid.h"
+
+#include <fstream>
+#include <iostream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// first line of the description of a tiled image followed by the version of the format
+const std::string TILES_HEADER = "pixelwise-annotation-tiles 1";
+// size of the tiles of completely decoded images
+const int DEFAULT_TILE_SIZE = 512;
+
+uint64_t
+tile_key(int level, int column, int row) {
+    return (static_cast<uint64_t>(level) << 56) | (static_cast<uint64_t>(row) << 28) | static_cast<uint64_t>(column);
+}
+
+size_t
+bytes_of(const cv::Mat& pixels) {
+    return pixels.total() * pixels.elemSize();
+}
+
+}
+
+bool
+is_tiled(const std::string& path) {
+    return fs::path(path).extension() == ".tiles";
+}
+
+TiledImage::TiledImage(const cv::Mat& image)
+    : base(image), baseSize(image.size()), tileSize(DEFAULT_TILE_SIZE), storedLevels(1),
+      tiles(DEFAULT_BUDGET, bytes_of), prefetchLevel(-1), stop(false) {
+}
+
+TiledImage::TiledImage(const std::string& directory, const cv::Size& size, int tileSize, int storedLevels,
+                       const std::string& extension, size_t budgetBytes)
+    : directory(directory), baseSize(size), tileSize(tileSize), storedLevels(storedLevels),
+      extension(extension), tiles(budgetBytes, bytes_of), prefetchLevel(-1), stop(false) {
+    worker = std::thread(&TiledImage::work, this);
+}
+
+TiledImage::~TiledImage() {
+    if (!worker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        requests.clear();
+    }
+    requested.notify_all();
+    worker.join();
+}
+
+std::shared_ptr<TiledImage>
+TiledImage::open(const std::string& path, size_t budgetBytes) {
+    if (!is_tiled(path)) {
+        cv::Mat image = cv::imread(path);
+        if (image.empty()) {
+            return nullptr;
+        }
+        return std::make_shared<TiledImage>(image);
+    }
+
+    std::ifstream in((fs::path(path) / "tiles.txt").string());
+    std::string header, extension;
+    int width, height, tileSize, storedLevels;
+    if (!std::getline(in, header) || header != TILES_HEADER
+            || !(in >> width >> height >> tileSize >> storedLevels >> extension)
+            || width <= 0 || height <= 0 || tileSize <= 0 || storedLevels <= 0) {
+        return nullptr;
+    }
+    return std::shared_ptr<TiledImage>(new TiledImage(path, cv::Size(width, height), tileSize, storedLevels,
+                                                      extension, budgetBytes));
+}
+
+cv::Size
+TiledImage::size(int level) const {
+    return level_size(baseSize, level);
+}
+
+void
+TiledImage::read(int level, const cv::Rect& region, cv::Mat& out) {
+    out.create(region.size(), CV_8UC3);
+    if (level == 0 && !base.empty()) {
+        base(region).copyTo(out);
+        return;
+    }
+    if (region.empty()) {
+        return;
+    }
+
+    for (int row = region.y / tileSize; row <= (region.y + region.height - 1) / tileSize; row++) {
+        for (int column = region.x / tileSize; column <= (region.x + region.width - 1) / tileSize; column++) {
+            const cv::Rect bounds = tileRect(level, column, row);
+            const cv::Rect part = bounds & region;
+            cv::Mat outPart = out(part - region.tl());
+            tile(level, column, row)(part - bounds.tl()).copyTo(outPart);
+        }
+    }
+}
+
+void
+TiledImage::prefetch(int level, const cv::Rect& region) {
+    // the tiles of completely decoded images are available immediately
+    if (directory.empty()) {
+        return;
+    }
+
+    // the requests of the same region are still queued or done
+    if (level == prefetchLevel && region == prefetchRegion) {
+        return;
+    }
+    prefetchLevel = level;
+    prefetchRegion = region;
+
+    const cv::Size levelSize = size(level);
+    const cv::Rect halo = cv::Rect(region.x - tileSize, region.y - tileSize,
+                                   region.width + 2 * tileSize, region.height + 2 * tileSize)
+        & cv::Rect(0, 0, levelSize.width, levelSize.height);
+    if (halo.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // requests of the previous region which were not started are obsolete
+        requests.clear();
+        for (int row = halo.y / tileSize; row <= (halo.y + halo.height - 1) / tileSize; row++) {
+            for (int column = halo.x / tileSize; column <= (halo.x + halo.width - 1) / tileSize; column++) {
+                const uint64_t key = tile_key(level, column, row);
+                if (!tiles.contains(key)) {
+                    requests.push_back(key);
+                }
+            }
+        }
+    }
+    requested.notify_all();
+}
+
+size_t
+TiledImage::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes_of(base) + tiles.bytes();
+}
+
+/**
+ * Retrieve a tile from the cache or decode it. Waits if the tile is currently
+ * decoded by another thread.
+ */
+cv::Mat
+TiledImage::tile(int level, int column, int row) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return tiles.get(lock, tile_key(level, column, row), [&]() { return decode(level, column, row); });
+}
+
+/**
+ * Decode a tile of a stored level or compute it from the next finer level.
+ */
+cv::Mat
+TiledImage::decode(int level, int column, int row) {
+    const cv::Rect bounds = tileRect(level, column, row);
+
+    if (!directory.empty() && level < storedLevels) {
+        const std::string file = (fs::path(directory) / std::to_string(level)
+                                  / (std::to_string(row) + "_" + std::to_string(column) + extension)).string();
+        cv::Mat pixels = cv::imread(file, cv::IMREAD_COLOR);
+        if (pixels.size() != bounds.size()) {
+            // a missing tile is displayed black instead of failing the whole image
+            std::cout << "Error! Could not load tile[" << file << "]!" << std::endl;
+            pixels = cv::Mat(bounds.size(), CV_8UC3, cv::Scalar(0, 0, 0));
+        }
+        return pixels;
+    }
+
+    const cv::Size finerSize = size(level - 1);
+    const cv::Rect finer = cv::Rect(2 * bounds.x, 2 * bounds.y, 2 * bounds.width, 2 * bounds.height)
+        & cv::Rect(0, 0, finerSize.width, finerSize.height);
+    cv::Mat source;
+    read(level - 1, finer, source);
+    cv::Mat pixels(bounds.size(), CV_8UC3);
+    downsample_mean(source, pixels);
+    return pixels;
+}
+
+/**
+ * Compute the region of a level covered by a tile.
+ */
+cv::Rect
+TiledImage::tileRect(int level, int column, int row) const {
+    const cv::Size levelSize = size(level);
+    return cv::Rect(column * tileSize, row * tileSize, tileSize, tileSize)
+        & cv::Rect(0, 0, levelSize.width, levelSize.height);
+}
+
+/**
+ * Main loop of the thread decoding prefetched tiles.
+ */
+void
+TiledImage::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        requested.wait(lock, [this]() { return stop || !requests.empty(); });
+        if (stop) {
+            return;
+        }
+
+        const uint64_t key = requests.front();
+        requests.pop_front();
+        // skip tiles which are already decoded or decoded by another thread
+        if (tiles.contains(key)) {
+            continue;
+        }
+        const int level = static_cast<int>(key >> 56);
+        const int column = static_cast<int>(key & 0xFFFFFFF);
+        const int row = static_cast<int>((key >> 28) & 0xFFFFFFF);
+        tiles.get(lock, key, [&]() { return decode(level, column, row); });
+    }
+}
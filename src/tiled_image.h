@@ -0,0 +1,106 @@
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+#include <opencv2/opencv.hpp>
+
+#include "lru_loader.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Check if a path names a tiled image or GT, i.e. a directory with the extension ".tiles".
+ */
+bool
+is_tiled(const std::string& path);
+
+/**
+ * BGR image which is read in tiles from every level of its pyramid (see pyramid.h).
+ *
+ * An image is either decoded completely, in which case the tiles of level 0 share its
+ * pixels, or it is a tiled image directory for inputs too large to be decoded at once
+ * (e.g. whole-slide or satellite images). A tiled image directory contains:
+ *   tiles.txt: "pixelwise-annotation-tiles 1" followed by the line
+ *              "<width> <height> <tile size> <stored levels> <extension>"
+ *   <level>/<row>_<column><extension>: the tiles of every stored level
+ * Tiles are only decoded when a region containing them is read or prefetched. Levels
+ * which are not stored are computed from the next finer level. Decoded and computed
+ * tiles are kept in an LRU cache within a memory budget.
+ *
+ * Prefetching decodes the tiles around a region in the background, so that panning
+ * rarely waits for decoding.
+ */
+class TiledImage {
+public:
+    // memory budget for decoded tiles of a tiled image
+    static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+    explicit TiledImage(const cv::Mat& image);
+    ~TiledImage();
+
+    TiledImage(const TiledImage&) = delete;
+    TiledImage& operator=(const TiledImage&) = delete;
+
+    /**
+     * Open an image file or a tiled image directory. Returns nullptr on failure.
+     */
+    static std::shared_ptr<TiledImage> open(const std::string& path, size_t budgetBytes = DEFAULT_BUDGET);
+
+    cv::Size size(int level = 0) const;
+
+    /**
+     * Copy a region (level coordinates) of a level into out, decoding the tiles
+     * which are missing. The region has to be inside the level.
+     */
+    void read(int level, const cv::Rect& region, cv::Mat& out);
+
+    /**
+     * Decode the tiles of a region (level coordinates) and of a halo of one tile
+     * around it in the background. Replaces the previous prefetch requests.
+     */
+    void prefetch(int level, const cv::Rect& region);
+
+    /**
+     * Memory used by decoded pixels.
+     */
+    size_t bytes() const;
+
+private:
+    TiledImage(const std::string& directory, const cv::Size& size, int tileSize, int storedLevels,
+               const std::string& extension, size_t budgetBytes);
+
+    cv::Mat tile(int level, int column, int row);
+    cv::Mat decode(int level, int column, int row);
+    cv::Rect tileRect(int level, int column, int row) const;
+    void work();
+
+    // completely decoded image, empty for tiled image directories
+    cv::Mat base;
+
+    std::string directory;
+    cv::Size baseSize;
+    int tileSize;
+    int storedLevels;
+    std::string extension;
+
+    mutable std::mutex mutex;
+    // wakes up the prefetch thread
+    std::condition_variable requested;
+
+    // decoded and computed tiles keyed by level, row and column
+    LruLoader<uint64_t, cv::Mat> tiles;
+    std::deque<uint64_t> requests;
+    // level and region of the last prefetch, which is not repeated every frame
+    int prefetchLevel;
+    cv::Rect prefetchRegion;
+
+    bool stop;
+    std::thread worker;
+};
+
+#endif // TILED_IMAGE_H
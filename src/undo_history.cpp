@@ -0,0 +1,231 @@
+#include "undo_history.h"
+
+#include "geometry.h"
+
+UndoHistory::UndoHistory(size_t budget, bool compress)
+    : budget(budget), compressSteps(compress), position(0), recording(false), recordedColumns(0), used(0) {}
+
+void
+UndoHistory::clear() {
+    steps.clear();
+    position = 0;
+    recording = false;
+    recorded.clear();
+    recordedColumns = 0;
+    used = 0;
+}
+
+void
+UndoHistory::begin() {
+    finish();
+    // undone steps are replaced by the new one
+    while (steps.size() > position) {
+        used -= steps.back().bytes;
+        steps.pop_back();
+    }
+    steps.push_back(Step());
+    steps.back().bytes = 0;
+    position = steps.size();
+    recording = true;
+}
+
+void
+UndoHistory::record(TiledGT& imageGT, const cv::Rect& region, uchar label) {
+    const cv::Rect image(cv::Point(0, 0), imageGT.size());
+    const cv::Rect clipped = region & image;
+    if (clipped.empty()) {
+        return;
+    }
+    // edits outside of a step form a step of their own
+    if (!recording) {
+        begin();
+    }
+    const size_t tiles = static_cast<size_t>(imageGT.columns()) * imageGT.rows();
+    if (recorded.size() != tiles || recordedColumns != imageGT.columns()) {
+        recorded.assign(tiles, false);
+        recordedColumns = imageGT.columns();
+    }
+
+    Step& step = steps.back();
+    const int tileSize = imageGT.tileSize();
+    for (int row = clipped.y / tileSize; row <= (clipped.y + clipped.height - 1) / tileSize; row++) {
+        for (int column = clipped.x / tileSize; column <= (clipped.x + clipped.width - 1) / tileSize; column++) {
+            const size_t index = static_cast<size_t>(row) * recordedColumns + column;
+            if (recorded[index]) {
+                continue;
+            }
+
+            Snapshot snapshot;
+            snapshot.column = column;
+            snapshot.row = row;
+            // the tile is only copied by the GT once it is edited
+            snapshot.pixels = imageGT.share(column, row);
+            if (snapshot.pixels.empty() && label == 0) {
+                continue;
+            }
+            recorded[index] = true;
+            snapshot.size = snapshot.pixels.size();
+            step.tiles.push_back(snapshot);
+            step.region = unite(step.region, cv::Rect(column * tileSize, row * tileSize, tileSize, tileSize) & image);
+            step.bytes += bytes(snapshot);
+            used += bytes(snapshot);
+        }
+    }
+}
+
+cv::Rect
+UndoHistory::undo(TiledGT& imageGT) {
+    finish();
+    if (position == 0) {
+        return cv::Rect();
+    }
+    position--;
+    const cv::Rect region = exchange(imageGT, steps[position]);
+    // the tiles taken from the GT may be larger than the ones restored
+    trim();
+    return region;
+}
+
+cv::Rect
+UndoHistory::redo(TiledGT& imageGT) {
+    finish();
+    if (position == steps.size()) {
+        return cv::Rect();
+    }
+    position++;
+    const cv::Rect region = exchange(imageGT, steps[position - 1]);
+    trim();
+    return region;
+}
+
+/**
+ * Exchange the tiles of a step with the tiles of the GT, which undoes a done step
+ * and redoes an undone one. Returns the region of the exchanged tiles.
+ */
+cv::Rect
+UndoHistory::exchange(TiledGT& imageGT, Step& step) {
+    used -= step.bytes;
+    step.bytes = 0;
+    for (Snapshot& snapshot : step.tiles) {
+        decompress(snapshot);
+        imageGT.exchange(snapshot.column, snapshot.row, snapshot.pixels);
+        snapshot.size = snapshot.pixels.size();
+        if (compressSteps) {
+            compress(snapshot);
+        }
+        step.bytes += bytes(snapshot);
+    }
+    used += step.bytes;
+    return step.region;
+}
+
+/**
+ * Finish the step which is recorded, compress it and forget the oldest steps
+ * exceeding the budget.
+ */
+void
+UndoHistory::finish() {
+    if (!recording) {
+        return;
+    }
+    recording = false;
+
+    // a step which did not change the GT would make undoing seem to do nothing
+    if (steps.back().tiles.empty()) {
+        steps.pop_back();
+        position--;
+        return;
+    }
+
+    Step& step = steps.back();
+    // only the flags of the tiles of the step are reset so that this does not depend on the size of the GT
+    for (const Snapshot& snapshot : step.tiles) {
+        recorded[static_cast<size_t>(snapshot.row) * recordedColumns + snapshot.column] = false;
+    }
+    if (compressSteps) {
+        used -= step.bytes;
+        step.bytes = 0;
+        for (Snapshot& snapshot : step.tiles) {
+            compress(snapshot);
+            step.bytes += bytes(snapshot);
+        }
+        used += step.bytes;
+    }
+    trim();
+}
+
+/**
+ * Forget the oldest steps until the history fits into the budget, and if that is not
+ * enough the undone steps furthest from being redone.
+ */
+void
+UndoHistory::trim() {
+    while (used > budget && position > 0) {
+        used -= steps.front().bytes;
+        steps.pop_front();
+        position--;
+    }
+    while (used > budget && steps.size() > position) {
+        used -= steps.back().bytes;
+        steps.pop_back();
+    }
+}
+
+/**
+ * Memory used by a recorded tile.
+ */
+size_t
+UndoHistory::bytes(const Snapshot& snapshot) {
+    return sizeof(Snapshot) + snapshot.pixels.total() * snapshot.pixels.elemSize() + snapshot.runs.capacity();
+}
+
+/**
+ * Replace the pixels of a recorded tile by runs of equal values.
+ */
+void
+UndoHistory::compress(Snapshot& snapshot) {
+    if (snapshot.pixels.empty()) {
+        return;
+    }
+    std::vector<uchar> runs;
+    for (int y = 0; y < snapshot.pixels.rows; y++) {
+        const uchar* row = snapshot.pixels.ptr<uchar>(y);
+        for (int x = 0; x < snapshot.pixels.cols; x++) {
+            // runs are continued across rows and limited to the range of a byte
+            if (!runs.empty() && runs[runs.size() - 1] == row[x] && runs[runs.size() - 2] < 255) {
+                runs[runs.size() - 2]++;
+            } else {
+                runs.push_back(1);
+                runs.push_back(row[x]);
+            }
+        }
+    }
+    runs.shrink_to_fit();
+    snapshot.runs.swap(runs);
+    snapshot.pixels.release();
+}
+
+/**
+ * Restore the pixels of a recorded tile from its runs.
+ */
+void
+UndoHistory::decompress(Snapshot& snapshot) {
+    if (snapshot.runs.empty()) {
+        return;
+    }
+    snapshot.pixels.create(snapshot.size, CV_8UC1);
+    size_t run = 0;
+    int remaining = snapshot.runs[0];
+    for (int y = 0; y < snapshot.pixels.rows; y++) {
+        uchar* row = snapshot.pixels.ptr<uchar>(y);
+        for (int x = 0; x < snapshot.pixels.cols; x++) {
+            if (remaining == 0) {
+                run += 2;
+                remaining = snapshot.runs[run];
+            }
+            row[x] = snapshot.runs[run + 1];
+            remaining--;
+        }
+    }
+    std::vector<uchar>().swap(snapshot.runs);
+}
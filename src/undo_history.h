@@ -0,0 +1,104 @@
+#ifndef UNDO_HISTORY_H
+#define UNDO_HISTORY_H
+
+#include <opencv2/opencv.hpp>
+
+#include "tiled_gt.h"
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+/**
+ * History of the edits of a GT which can be undone and redone step by step.
+ *
+ * A step only keeps the tiles it edited, as they were before the step. The tiles
+ * are not copied when they are recorded but shared with the GT (see TiledGT::share),
+ * which copies a tile only if it is edited afterwards. Undoing or redoing a step
+ * exchanges its tiles with the tiles of the GT, so that it costs time proportional
+ * to the number of tiles of the step.
+ *
+ * Finished steps may be compressed with a run length encoding, which suits masks
+ * consisting of few large regions. The oldest steps are forgotten once the steps
+ * use more memory than the budget.
+ */
+class UndoHistory {
+public:
+    /**
+     * Create a history using at most budget bytes for finished steps.
+     */
+    explicit UndoHistory(size_t budget, bool compress = false);
+
+    /**
+     * Forget all steps, e.g. because another GT is edited.
+     */
+    void clear();
+
+    /**
+     * Start a new step, e.g. for a new stroke. Steps which were undone cannot be redone anymore.
+     */
+    void begin();
+
+    /**
+     * Record the tiles of a GT intersecting a region (image coordinates) before it is painted
+     * with a label by the current step. Tiles already recorded by the step are skipped, as
+     * are unallocated tiles which are erased since the step cannot change them.
+     */
+    void record(TiledGT& imageGT, const cv::Rect& region, uchar label);
+
+    /**
+     * Undo the newest step which was not undone yet.
+     * Returns the region of the GT (image coordinates) which changed.
+     */
+    cv::Rect undo(TiledGT& imageGT);
+
+    /**
+     * Redo the oldest undone step.
+     * Returns the region of the GT (image coordinates) which changed.
+     */
+    cv::Rect redo(TiledGT& imageGT);
+
+    /**
+     * Memory used by the tiles of all steps.
+     */
+    size_t bytes() const { return used; }
+
+private:
+    struct Snapshot {
+        int column;
+        int row;
+        // pixels of the tile, empty if it was not allocated or is compressed
+        cv::Mat pixels;
+        // run length encoded pixels as pairs of length and value
+        std::vector<uchar> runs;
+        cv::Size size;
+    };
+
+    struct Step {
+        std::vector<Snapshot> tiles;
+        // region of the GT covered by the tiles
+        cv::Rect region;
+        size_t bytes;
+    };
+
+    cv::Rect exchange(TiledGT& imageGT, Step& step);
+    void finish();
+    void trim();
+    static size_t bytes(const Snapshot& snapshot);
+    static void compress(Snapshot& snapshot);
+    static void decompress(Snapshot& snapshot);
+
+    size_t budget;
+    bool compressSteps;
+    // steps in the order they were done, the first position steps can be undone
+    std::deque<Step> steps;
+    size_t position;
+    // if the last step can still be extended
+    bool recording;
+    // tiles recorded by the current step in row major order
+    std::vector<bool> recorded;
+    int recordedColumns;
+    size_t used;
+};
+
+#endif // UNDO_HISTORY_H